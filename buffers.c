@@ -0,0 +1,568 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://opensource.org/licenses/CDDL-1.0
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+/*
+ * Copyright 2014 by Saso Kiselkov. All rights reserved.
+ */
+
+/*
+ * Buffer allocation policies for the speed test, to see how much page
+ * size and placement matter for AES/GCM throughput:
+ *
+ *	base	kmem_zalloc(), i.e. base pages out of the kernel heap
+ *	large	physically contiguous memory mapped through a 2 MiB aligned
+ *		heap range with hat_devload(), which uses large pages
+ *		wherever alignment allows
+ *	arena	both buffers packed into one vmem arena with a cache line
+ *		quantum, so they're cache line but not page aligned
+ *	local	base pages allocated from a CPU in the benchmark CPU's
+ *		lgroup
+ *	remote	base pages allocated from a CPU in another lgroup
+ *
+ * Kernel heap pages come from the allocating thread's home lgroup, which
+ * binding to a CPU doesn't change, so bench_bind() also moves the
+ * thread's home to the CPU's lgroup for as long as it stays bound. The
+ * kernel still only treats that as a preference, so we check where the
+ * pages actually landed and skip the policy if fewer than
+ * BUF_LGRP_MIN_PCT percent of them are on target. Likewise, large skips
+ * itself if the HAT didn't map its buffers with 2 MiB pages.
+ *
+ * Which policies run is picked per run with crypto_test_buf_policies
+ * (a bitmask of 1 << BUF_POLICY_*), and the benchmark runs bound to
+ * crypto_test_bench_cpu (-1 for whichever CPU we happen to be on).
+ *
+ * dTLB misses are counted with two of the architectural performance
+ * counters, programmed directly on the bound CPU. This only works on
+ * Intel CPUs and clobbers whatever cpc(3CPC) consumers had on those
+ * counters, so don't run cpustat or the DTrace cpc provider alongside.
+ * The default events are DTLB_LOAD_MISSES.MISS_CAUSES_A_WALK and
+ * DTLB_STORE_MISSES.MISS_CAUSES_A_WALK (umask << 8 | event), which
+ * exist from Nehalem onwards; adjust crypto_test_tlb_events for other
+ * parts.
+ */
+
+#include <sys/types.h>
+#include <sys/cmn_err.h>
+#include <sys/ddi.h>
+#include <sys/sunddi.h>
+#include <sys/ddidmareq.h>
+#include <sys/thread.h>
+#include <sys/cpuvar.h>
+#include <sys/lgrp.h>
+#include <sys/vmem.h>
+#include <sys/mman.h>
+#include <sys/systm.h>
+#include <sys/sysmacros.h>
+#include <sys/sdt.h>
+#include <sys/x86_archext.h>
+#include <vm/hat.h>
+#include <vm/seg_kmem.h>
+#include <sys/crypto/common.h>
+#include <sys/crypto/api.h>
+
+#include "crypto_test.h"
+
+#define	BUF_LPSIZE	(2 * 1024 * 1024)
+#define	BUF_CLSIZE	64
+#define	BUF_LGRP_MIN_PCT	90
+
+#define	MSR_PERFEVTSEL(n)	(0x186 + (n))
+#define	MSR_PMC(n)		(0xc1 + (n))
+#define	MSR_PERF_GLOBAL_CTRL	0x38f
+#define	PERFEVTSEL_USR		(1ULL << 16)
+#define	PERFEVTSEL_OS		(1ULL << 17)
+#define	PERFEVTSEL_EN		(1ULL << 22)
+#define	TLB_NCTRS		2
+
+/* not in any header we can include, see i86pc/os/ddi_impl.c */
+extern void *contig_alloc(size_t, ddi_dma_attr_t *, uintptr_t, int);
+extern void contig_free(void *, size_t);
+
+uint_t crypto_test_buf_policies = BUF_ALL;
+int crypto_test_bench_cpu = -1;
+uint_t crypto_test_tlb_events[TLB_NCTRS] = { 0x0108, 0x0149 };
+
+static const char *buf_policy_names[] = {
+	"base", "large", "arena", "local", "remote"
+};
+
+typedef struct tlb_ctrs {
+	boolean_t	tc_ok;
+	uint64_t	tc_saved_sel[TLB_NCTRS];
+	uint64_t	tc_saved_global;
+	boolean_t	tc_have_global;
+	uint64_t	tc_count[TLB_NCTRS];
+} tlb_ctrs_t;
+
+static ddi_dma_attr_t buf_lp_attr = {
+	.dma_attr_version =	DMA_ATTR_V0,
+	.dma_attr_addr_lo =	0,
+	.dma_attr_addr_hi =	UINT64_MAX,
+	.dma_attr_count_max =	UINT64_MAX,
+	.dma_attr_align =	BUF_LPSIZE,
+	.dma_attr_burstsizes =	1,
+	.dma_attr_minxfer =	1,
+	.dma_attr_maxxfer =	UINT64_MAX,
+	.dma_attr_seg =		UINT64_MAX,
+	.dma_attr_sgllen =	1,
+	.dma_attr_granular =	1,
+	.dma_attr_flags =	0
+};
+
+static uint8_t *
+buf_alloc_large(bench_buf_t *bb)
+{
+	bb->bb_alloc = P2ROUNDUP(bb->bb_size, BUF_LPSIZE);
+	bb->bb_cookie = contig_alloc(bb->bb_alloc, &buf_lp_attr, BUF_LPSIZE,
+	    1);
+	if (bb->bb_cookie == NULL)
+		return (NULL);
+	bb->bb_va = vmem_xalloc(heap_arena, bb->bb_alloc, BUF_LPSIZE, 0, 0,
+	    NULL, NULL, VM_SLEEP);
+	hat_devload(kas.a_hat, (caddr_t)bb->bb_va, bb->bb_alloc,
+	    hat_getpfnum(kas.a_hat, bb->bb_cookie),
+	    PROT_READ | PROT_WRITE | HAT_NOSYNC, HAT_LOAD_LOCK);
+	bzero(bb->bb_va, bb->bb_alloc);
+
+	return (bb->bb_va);
+}
+
+/*
+ * Allocates base pages while bound to and homed on `cpu', so that they
+ * come from its lgroup. The size is padded past the largest kmem cache
+ * so that we get fresh pages from the heap rather than a recycled buffer
+ * which may live anywhere.
+ */
+static uint8_t *
+buf_alloc_on(bench_buf_t *bb, processorid_t cpu)
+{
+	lpl_t *home;
+
+	bb->bb_alloc = P2ROUNDUP(bb->bb_size, PAGESIZE) + PAGESIZE;
+	if (!bench_bind(cpu, &home))
+		return (NULL);
+	bb->bb_va = kmem_zalloc(bb->bb_alloc, KM_SLEEP);
+	bench_unbind(home);
+
+	return (bb->bb_va);
+}
+
+static uint8_t *
+buf_alloc(bench_bufs_t *bufs, bench_buf_t *bb, size_t size)
+{
+	bb->bb_size = size;
+	bb->bb_alloc = size;
+	bb->bb_cookie = NULL;
+
+	switch (bufs->bbs_policy) {
+	case BUF_POLICY_LARGE:
+		return (buf_alloc_large(bb));
+	case BUF_POLICY_ARENA:
+		bb->bb_alloc = P2ROUNDUP(size, BUF_CLSIZE);
+		bb->bb_va = vmem_alloc(bufs->bbs_arena, bb->bb_alloc,
+		    VM_SLEEP);
+		bzero(bb->bb_va, bb->bb_alloc);
+		return (bb->bb_va);
+	case BUF_POLICY_LOCAL:
+	case BUF_POLICY_REMOTE:
+		return (buf_alloc_on(bb, bufs->bbs_mem_cpu));
+	default:
+		bb->bb_va = kmem_zalloc(size, KM_SLEEP);
+		return (bb->bb_va);
+	}
+}
+
+static void
+buf_free(bench_bufs_t *bufs, bench_buf_t *bb)
+{
+	if (bb->bb_va == NULL)
+		return;
+
+	switch (bufs->bbs_policy) {
+	case BUF_POLICY_LARGE:
+		hat_unload(kas.a_hat, (caddr_t)bb->bb_va, bb->bb_alloc,
+		    HAT_UNLOAD_UNLOCK);
+		vmem_xfree(heap_arena, bb->bb_va, bb->bb_alloc);
+		contig_free(bb->bb_cookie, bb->bb_alloc);
+		break;
+	case BUF_POLICY_ARENA:
+		vmem_free(bufs->bbs_arena, bb->bb_va, bb->bb_alloc);
+		break;
+	default:
+		kmem_free(bb->bb_va, bb->bb_alloc);
+		break;
+	}
+	bb->bb_va = NULL;
+}
+
+lgrp_id_t
+cpu_lgrp(processorid_t id)
+{
+	return (cpu[id]->cpu_lpl->lpl_lgrpid);
+}
+
+/*
+ * Finds an online CPU in (or, with `same' unset, outside) the lgroup of
+ * `id'. Returns -1 if there is none.
+ */
+processorid_t
+cpu_find_lgrp_peer(processorid_t id, boolean_t same)
+{
+	processorid_t found = -1;
+	cpu_t *cp;
+
+	mutex_enter(&cpu_lock);
+	cp = cpu_list;
+	do {
+		if (cp->cpu_id != id && cpu_is_online(cp) &&
+		    (cp->cpu_lpl->lpl_lgrpid == cpu_lgrp(id)) == same) {
+			found = cp->cpu_id;
+			break;
+		}
+		cp = cp->cpu_next;
+	} while (cp != cpu_list);
+	mutex_exit(&cpu_lock);
+
+	return (found);
+}
+
+/*
+ * Returns how many percent of the pages backing `bb' actually live in
+ * lgroup `lgrp', as the kernel's placement is only a preference.
+ */
+static int
+buf_lgrp_pct(const bench_buf_t *bb, lgrp_id_t lgrp)
+{
+	size_t npages = 0, nlocal = 0;
+
+	for (size_t off = 0; off < bb->bb_size; off += PAGESIZE) {
+		pfn_t pfn = hat_getpfnum(kas.a_hat,
+		    (caddr_t)bb->bb_va + off);
+		lgrp_t *lg = lgrp_pfn_to_lgrp(pfn);
+
+		npages++;
+		if (lg != NULL && lg->lgrp_id == lgrp)
+			nlocal++;
+	}
+
+	return (npages == 0 ? 0 : (int)(nlocal * 100 / npages));
+}
+
+static boolean_t
+bench_bufs_setup(bench_bufs_t *bufs, buf_policy_t policy,
+    processorid_t bench_cpu)
+{
+	bzero(bufs, sizeof (*bufs));
+	bufs->bbs_policy = policy;
+	bufs->bbs_mem_cpu = bench_cpu;
+	bufs->bbs_lgrp_pct = -1;
+	bufs->bbs_pgsize = -1;
+
+	switch (policy) {
+	case BUF_POLICY_ARENA:
+		bufs->bbs_span_len = P2ROUNDUP(ENCBLKSZ, BUF_CLSIZE) +
+		    P2ROUNDUP(SPEED_OUTLEN, BUF_CLSIZE) + BUF_CLSIZE;
+		bufs->bbs_span = kmem_alloc(bufs->bbs_span_len, KM_SLEEP);
+		/* start one cache line in, so nothing is page aligned */
+		bufs->bbs_arena = vmem_create("crypto_test_arena",
+		    (caddr_t)bufs->bbs_span + BUF_CLSIZE,
+		    bufs->bbs_span_len - BUF_CLSIZE, BUF_CLSIZE, NULL, NULL,
+		    NULL, 0, VM_SLEEP);
+		break;
+	case BUF_POLICY_REMOTE:
+		bufs->bbs_mem_cpu = cpu_find_lgrp_peer(bench_cpu, B_FALSE);
+		if (bufs->bbs_mem_cpu == -1)
+			return (B_FALSE);
+		break;
+	default:
+		break;
+	}
+
+	if (buf_alloc(bufs, &bufs->bbs_in, ENCBLKSZ) == NULL ||
+	    buf_alloc(bufs, &bufs->bbs_out, SPEED_OUTLEN) == NULL) {
+		bench_bufs_free(bufs);
+		return (B_FALSE);
+	}
+
+	if (policy == BUF_POLICY_LARGE) {
+		bufs->bbs_pgsize = MIN(hat_getpagesize(kas.a_hat,
+		    (caddr_t)bufs->bbs_in.bb_va), hat_getpagesize(kas.a_hat,
+		    (caddr_t)bufs->bbs_out.bb_va));
+		if (bufs->bbs_pgsize < BUF_LPSIZE) {
+			bench_bufs_free(bufs);
+			return (B_FALSE);
+		}
+	}
+	if (policy == BUF_POLICY_LOCAL || policy == BUF_POLICY_REMOTE) {
+		lgrp_id_t lgrp = cpu_lgrp(bufs->bbs_mem_cpu);
+
+		bufs->bbs_lgrp_pct = MIN(buf_lgrp_pct(&bufs->bbs_in, lgrp),
+		    buf_lgrp_pct(&bufs->bbs_out, lgrp));
+		if (bufs->bbs_lgrp_pct < BUF_LGRP_MIN_PCT) {
+			bench_bufs_free(bufs);
+			return (B_FALSE);
+		}
+	}
+
+	return (B_TRUE);
+}
+
+/*
+ * Allocates the speed test input and output buffers under `policy'.
+ * For the NUMA policies `bench_cpu' is the CPU the benchmark will run
+ * on. Returns B_FALSE if the policy can't be honored on this machine,
+ * including when the NUMA policies missed their lgroup (bbs_lgrp_pct is
+ * then left set to how much of the memory did land there) or large
+ * didn't get large pages (bbs_pgsize is left set to what it got).
+ */
+boolean_t
+bench_bufs_alloc(bench_bufs_t *bufs, buf_policy_t policy,
+    processorid_t bench_cpu)
+{
+	boolean_t ok;
+
+	DTRACE_PROBE3(crypto_test__bufs__start, int, policy, size_t,
+	    ENCBLKSZ + SPEED_OUTLEN, kthread_t *, curthread);
+	ok = bench_bufs_setup(bufs, policy, bench_cpu);
+	DTRACE_PROBE3(crypto_test__bufs__done, int, policy, boolean_t, ok,
+	    kthread_t *, curthread);
+
+	return (ok);
+}
+
+void
+bench_bufs_free(bench_bufs_t *bufs)
+{
+	buf_free(bufs, &bufs->bbs_in);
+	buf_free(bufs, &bufs->bbs_out);
+	if (bufs->bbs_arena != NULL) {
+		vmem_destroy(bufs->bbs_arena);
+		kmem_free(bufs->bbs_span, bufs->bbs_span_len);
+	}
+}
+
+static void
+tlb_ctrs_start(tlb_ctrs_t *tc)
+{
+	int nsaved = 0;
+
+	bzero(tc, sizeof (*tc));
+	if (cpuid_getvendor(CPU) != X86_VENDOR_Intel)
+		return;
+
+	tc->tc_have_global = (checked_rdmsr(MSR_PERF_GLOBAL_CTRL,
+	    &tc->tc_saved_global) == 0);
+	for (int i = 0; i < TLB_NCTRS; i++) {
+		if (checked_rdmsr(MSR_PERFEVTSEL(i),
+		    &tc->tc_saved_sel[i]) != 0)
+			goto errout;
+		nsaved++;
+		if (checked_wrmsr(MSR_PERFEVTSEL(i), crypto_test_tlb_events[i] |
+		    PERFEVTSEL_USR | PERFEVTSEL_OS | PERFEVTSEL_EN) != 0 ||
+		    checked_wrmsr(MSR_PMC(i), 0) != 0)
+			goto errout;
+	}
+	if (tc->tc_have_global) {
+		(void) checked_wrmsr(MSR_PERF_GLOBAL_CTRL,
+		    tc->tc_saved_global | ((1ULL << TLB_NCTRS) - 1));
+	}
+	tc->tc_ok = B_TRUE;
+	return;
+
+errout:
+	/* put back whatever we already reprogrammed */
+	for (int i = 0; i < nsaved; i++)
+		(void) checked_wrmsr(MSR_PERFEVTSEL(i), tc->tc_saved_sel[i]);
+}
+
+static void
+tlb_ctrs_stop(tlb_ctrs_t *tc)
+{
+	if (!tc->tc_ok)
+		return;
+	for (int i = 0; i < TLB_NCTRS; i++) {
+		(void) checked_rdmsr(MSR_PMC(i), &tc->tc_count[i]);
+		(void) checked_wrmsr(MSR_PERFEVTSEL(i), tc->tc_saved_sel[i]);
+	}
+	if (tc->tc_have_global)
+		(void) checked_wrmsr(MSR_PERF_GLOBAL_CTRL, tc->tc_saved_global);
+}
+
+processorid_t
+bench_cpu(void)
+{
+	processorid_t id = crypto_test_bench_cpu;
+
+	if (id < 0 || id >= max_ncpus || cpu[id] == NULL ||
+	    !cpu_is_online(cpu[id]))
+		id = CPU->cpu_id;
+
+	return (id);
+}
+
+/*
+ * Moves curthread's home lgroup to `lpl' the way cpu_bind_thread() does,
+ * returning the old one in `*homep' unless that is NULL.
+ */
+static void
+bench_move_home(lpl_t *lpl, lpl_t **homep)
+{
+	ASSERT(MUTEX_HELD(&cpu_lock));
+	thread_lock(curthread);
+	if (homep != NULL)
+		*homep = curthread->t_lpl;
+	lgrp_move_thread(curthread, lpl, 1);
+	thread_unlock(curthread);
+}
+
+/*
+ * Homes curthread on the lgroup of CPU `id', so that its kernel memory
+ * comes from there, and returns the old home in `*homep' for
+ * bench_unhome(). Returns B_FALSE if the CPU has gone offline.
+ */
+boolean_t
+bench_rehome(processorid_t id, lpl_t **homep)
+{
+	boolean_t ok;
+
+	mutex_enter(&cpu_lock);
+	ok = (cpu[id] != NULL && cpu_is_online(cpu[id]));
+	if (ok)
+		bench_move_home(cpu[id]->cpu_lpl, homep);
+	mutex_exit(&cpu_lock);
+
+	return (ok);
+}
+
+/*
+ * Undoes bench_rehome(). Our threads all live in the default partition,
+ * which is never destroyed, so the old lpl is still valid.
+ */
+void
+bench_unhome(lpl_t *home)
+{
+	mutex_enter(&cpu_lock);
+	bench_move_home(home, NULL);
+	mutex_exit(&cpu_lock);
+}
+
+/*
+ * Binds curthread to CPU `id' under cpu_lock, so that the CPU can't go
+ * offline under us, and homes it there like bench_rehome(). Returns
+ * B_FALSE if the CPU has already gone offline.
+ */
+boolean_t
+bench_bind(processorid_t id, lpl_t **homep)
+{
+	boolean_t ok;
+
+	mutex_enter(&cpu_lock);
+	ok = (cpu[id] != NULL && cpu_is_online(cpu[id]));
+	if (ok) {
+		thread_affinity_set(curthread, id);
+		bench_move_home(cpu[id]->cpu_lpl, homep);
+	}
+	mutex_exit(&cpu_lock);
+
+	return (ok);
+}
+
+void
+bench_unbind(lpl_t *home)
+{
+	bench_unhome(home);
+	thread_affinity_clear(curthread);
+}
+
+static void
+speed_test_policy(buf_policy_t policy, processorid_t id)
+{
+	bench_bufs_t bufs;
+	char where[32] = "";
+	lpl_t *home;
+
+	if (!bench_bufs_alloc(&bufs, policy, id)) {
+		if (bufs.bbs_pgsize != -1) {
+			cmn_err(CE_NOTE, "B[%s]: skipped, mapped with %ld KiB "
+			    "pages", buf_policy_names[policy],
+			    (long)bufs.bbs_pgsize >> 10);
+		} else if (bufs.bbs_lgrp_pct != -1) {
+			cmn_err(CE_NOTE, "B[%s]: skipped, only %d%% of the "
+			    "pages landed on lgrp %d", buf_policy_names[policy],
+			    bufs.bbs_lgrp_pct, (int)cpu_lgrp(bufs.bbs_mem_cpu));
+		} else {
+			cmn_err(CE_NOTE, "B[%s]: not available on this system",
+			    buf_policy_names[policy]);
+		}
+		return;
+	}
+	if (bufs.bbs_lgrp_pct != -1) {
+		(void) snprintf(where, sizeof (where), ", %d%% on lgrp %d",
+		    bufs.bbs_lgrp_pct, (int)cpu_lgrp(bufs.bbs_mem_cpu));
+	}
+	if (!bench_bind(id, &home)) {
+		cmn_err(CE_NOTE, "B[%s]: cpu %d went offline",
+		    buf_policy_names[policy], id);
+		bench_bufs_free(&bufs);
+		return;
+	}
+
+	for (int i = 0; i < ARRAY_SIZE(aes_mechs); i++) {
+		tlb_ctrs_t tc;
+		uint64_t rate, processed = 0;
+
+		tlb_ctrs_start(&tc);
+		rate = speed_run(aes_mechs[i], B_TRUE, bufs.bbs_in.bb_va,
+		    bufs.bbs_out.bb_va, &processed);
+		tlb_ctrs_stop(&tc);
+		if (rate == 0)
+			continue;
+
+		if (tc.tc_ok) {
+			cmn_err(CE_NOTE, "B[%s] E[%s] cpu %d: %llu MB/s, "
+			    "dTLB misses/MiB: %llu load, %llu store%s",
+			    buf_policy_names[policy], aes_mechs[i], id,
+			    (unsigned long long)rate >> 20,
+			    (unsigned long long)(tc.tc_count[0] /
+			    MAX(processed >> 20, 1)),
+			    (unsigned long long)(tc.tc_count[1] /
+			    MAX(processed >> 20, 1)), where);
+		} else {
+			cmn_err(CE_NOTE, "B[%s] E[%s] cpu %d: %llu MB/s, "
+			    "dTLB misses n/a%s", buf_policy_names[policy],
+			    aes_mechs[i], id, (unsigned long long)rate >> 20,
+			    where);
+		}
+	}
+	bench_unbind(home);
+
+	bench_bufs_free(&bufs);
+}
+
+void
+speed_test_buffers(void)
+{
+	processorid_t id = bench_cpu();
+
+	for (int p = 0; p < BUF_NPOLICIES; p++) {
+		if (crypto_test_buf_policies & (1 << p))
+			speed_test_policy(p, id);
+	}
+}
@@ -0,0 +1,726 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://opensource.org/licenses/CDDL-1.0
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+/*
+ * Copyright 2014 by Saso Kiselkov. All rights reserved.
+ */
+
+/*
+ * NIST CAVP vector engine.
+ *
+ * Loads the AES .rsp response files from the CAVP validation suites:
+ *	http://csrc.nist.gov/groups/STM/cavp/documents/aes/KAT_AES.zip
+ *	http://csrc.nist.gov/groups/STM/cavp/documents/aes/aesmmt.zip
+ *	http://csrc.nist.gov/groups/STM/cavp/documents/aes/aesmct.zip
+ *	http://csrc.nist.gov/groups/STM/cavp/documents/mac/gcmtestvectors.zip
+ * out of crypto_test_cavp_dir, compiles every record into a single
+ * table of fixed-size descriptors pointing into one shared byte arena
+ * and then runs the whole table on a taskq with one thread per CPU.
+ * Files which aren't present are skipped, so dropping only a subset
+ * of the suites into the directory is fine.
+ *
+ * Monte Carlo records are checked individually: each record carries
+ * the key, IV and input for its outer iteration, so we only run the
+ * 1000 inner iterations of AESAVS section 6.4 and compare against the
+ * record's result. That keeps every record independent and lets the
+ * MCT files spread across CPUs just like the rest.
+ */
+
+#include <sys/types.h>
+#include <sys/cmn_err.h>
+#include <sys/kobj.h>
+#include <sys/taskq.h>
+#include <sys/atomic.h>
+#include <sys/cpuvar.h>
+#include <sys/disp.h>
+#include <sys/systm.h>
+#include <sys/sysmacros.h>
+#include <sys/crypto/common.h>
+#include <sys/crypto/api.h>
+
+#include "crypto_test.h"
+
+#define	CAVP_FIELD_MAX	256	/* longest hex field we accept, in bytes */
+#define	CAVP_MCT_ITER	1000
+#define	CAVP_MAX_REPORT	32	/* cap on per-vector failure messages */
+#define	CAVP_TASKS_PER_CPU	4
+
+char *crypto_test_cavp_dir = "/usr/share/crypto_test/cavp";
+
+typedef enum cavp_mode {
+	CAVP_ECB,
+	CAVP_CBC,
+	CAVP_CTR,
+	CAVP_GCM
+} cavp_mode_t;
+
+typedef enum cavp_dir {
+	CAVP_DIR_SECTION,	/* from [ENCRYPT]/[DECRYPT] headers */
+	CAVP_DIR_ENCRYPT,
+	CAVP_DIR_DECRYPT
+} cavp_dir_t;
+
+typedef struct cavp_suite {
+	const char	*cs_prefix;
+	cavp_mode_t	cs_mode;
+	cavp_dir_t	cs_dir;
+	boolean_t	cs_mct;
+} cavp_suite_t;
+
+/*
+ * Every suite exists in 128, 192 and 256-bit key variants, named
+ * <prefix><keybits>.rsp. NIST doesn't publish CTR response files (the
+ * AESAVS covers CTR through ECB), so CTRMMT only gets picked up if one
+ * has been generated locally in the CBCMMT format.
+ */
+static const cavp_suite_t cavp_suites[] = {
+	{ "ECBGFSbox",		CAVP_ECB, CAVP_DIR_SECTION, B_FALSE },
+	{ "ECBKeySbox",		CAVP_ECB, CAVP_DIR_SECTION, B_FALSE },
+	{ "ECBVarKey",		CAVP_ECB, CAVP_DIR_SECTION, B_FALSE },
+	{ "ECBVarTxt",		CAVP_ECB, CAVP_DIR_SECTION, B_FALSE },
+	{ "ECBMMT",		CAVP_ECB, CAVP_DIR_SECTION, B_FALSE },
+	{ "ECBMCT",		CAVP_ECB, CAVP_DIR_SECTION, B_TRUE },
+	{ "CBCGFSbox",		CAVP_CBC, CAVP_DIR_SECTION, B_FALSE },
+	{ "CBCKeySbox",		CAVP_CBC, CAVP_DIR_SECTION, B_FALSE },
+	{ "CBCVarKey",		CAVP_CBC, CAVP_DIR_SECTION, B_FALSE },
+	{ "CBCVarTxt",		CAVP_CBC, CAVP_DIR_SECTION, B_FALSE },
+	{ "CBCMMT",		CAVP_CBC, CAVP_DIR_SECTION, B_FALSE },
+	{ "CBCMCT",		CAVP_CBC, CAVP_DIR_SECTION, B_TRUE },
+	{ "CTRMMT",		CAVP_CTR, CAVP_DIR_SECTION, B_FALSE },
+	{ "gcmEncryptExtIV",	CAVP_GCM, CAVP_DIR_ENCRYPT, B_FALSE },
+	{ "gcmDecrypt",		CAVP_GCM, CAVP_DIR_DECRYPT, B_FALSE }
+};
+static const int cavp_keybits[] = { 128, 192, 256 };
+#define	CAVP_NFILES	(ARRAY_SIZE(cavp_suites) * ARRAY_SIZE(cavp_keybits))
+
+#define	CAVP_F_ENCRYPT	0x01
+#define	CAVP_F_MCT	0x02
+#define	CAVP_F_FAIL	0x04	/* GCM decrypt, tag must be rejected */
+
+/*
+ * One compiled vector. The variable-length fields live back to back in
+ * the table arena starting at cv_off, in the order key, IV, AAD, input,
+ * expected output (absent for CAVP_F_FAIL) and tag. For GCM encryption
+ * the tag is part of the expected output, for decryption it's input.
+ */
+typedef struct cavp_vec {
+	uint32_t	cv_off;
+	uint32_t	cv_len;
+	uint16_t	cv_file;
+	uint16_t	cv_count;
+	uint16_t	cv_aad_len;
+	uint8_t		cv_key_len;
+	uint8_t		cv_iv_len;
+	uint8_t		cv_tag_len;
+	uint8_t		cv_flags;
+} cavp_vec_t;
+
+#define	CV_KEY(tab, cv)	((tab)->ct_data + (cv)->cv_off)
+#define	CV_IV(tab, cv)	(CV_KEY(tab, cv) + (cv)->cv_key_len)
+#define	CV_AAD(tab, cv)	(CV_IV(tab, cv) + (cv)->cv_iv_len)
+#define	CV_IN(tab, cv)	(CV_AAD(tab, cv) + (cv)->cv_aad_len)
+#define	CV_OUT(tab, cv)	(CV_IN(tab, cv) + (cv)->cv_len)
+#define	CV_TAG(tab, cv)	(CV_OUT(tab, cv) + \
+	(((cv)->cv_flags & CAVP_F_FAIL) ? 0 : (cv)->cv_len))
+
+typedef struct cavp_table {
+	cavp_vec_t	*ct_vecs;
+	size_t		ct_nvecs;
+	size_t		ct_vecs_cap;
+	uint8_t		*ct_data;
+	size_t		ct_data_len;
+	size_t		ct_data_cap;
+	char		*ct_files[CAVP_NFILES];
+	cavp_mode_t	ct_modes[CAVP_NFILES];
+} cavp_table_t;
+
+typedef enum cavp_field {
+	CF_KEY,
+	CF_IV,
+	CF_PT,
+	CF_CT,
+	CF_AAD,
+	CF_TAG,
+	CF_NFIELDS
+} cavp_field_t;
+
+static const struct {
+	const char	*name;
+	cavp_field_t	field;
+} cavp_field_names[] = {
+	{ "KEY",	CF_KEY },
+	{ "Key",	CF_KEY },
+	{ "IV",		CF_IV },
+	{ "PLAINTEXT",	CF_PT },
+	{ "PT",		CF_PT },
+	{ "CIPHERTEXT",	CF_CT },
+	{ "CT",		CF_CT },
+	{ "AAD",	CF_AAD },
+	{ "Tag",	CF_TAG }
+};
+
+/* Parser state for the record currently being assembled. */
+typedef struct cavp_rec {
+	boolean_t	cr_present[CF_NFIELDS];
+	size_t		cr_len[CF_NFIELDS];
+	uint8_t		cr_data[CF_NFIELDS][CAVP_FIELD_MAX];
+	int		cr_count;
+	boolean_t	cr_fail;
+	boolean_t	cr_any;
+} cavp_rec_t;
+
+typedef struct cavp_stats {
+	uint64_t	cs_nmct;
+	uint64_t	cs_passed;
+	uint64_t	cs_failed;
+	uint64_t	cs_malformed;
+	uint32_t	cs_reported;
+	int		cs_nfiles;
+	int		cs_missing;
+} cavp_stats_t;
+
+typedef struct cavp_task {
+	const cavp_table_t	*tk_tab;
+	cavp_stats_t		*tk_stats;
+	size_t			tk_first;
+	size_t			tk_stride;
+} cavp_task_t;
+
+static void *
+cavp_grow(void *buf, size_t *cap, size_t used, size_t need, size_t elemsz)
+{
+	size_t newcap;
+	void *newbuf;
+
+	if (used + need <= *cap)
+		return (buf);
+	newcap = MAX(*cap * 2, 64);
+	while (newcap < used + need)
+		newcap *= 2;
+	newbuf = kmem_alloc(newcap * elemsz, KM_SLEEP);
+	if (buf != NULL) {
+		bcopy(buf, newbuf, used * elemsz);
+		kmem_free(buf, *cap * elemsz);
+	}
+	*cap = newcap;
+
+	return (newbuf);
+}
+
+static void
+cavp_table_free(cavp_table_t *tab)
+{
+	if (tab->ct_vecs != NULL)
+		kmem_free(tab->ct_vecs, tab->ct_vecs_cap * sizeof (cavp_vec_t));
+	if (tab->ct_data != NULL)
+		kmem_free(tab->ct_data, tab->ct_data_cap);
+	for (int i = 0; i < CAVP_NFILES; i++) {
+		if (tab->ct_files[i] != NULL)
+			strfree(tab->ct_files[i]);
+	}
+}
+
+static int
+cavp_hexval(char c)
+{
+	if (c >= '0' && c <= '9')
+		return (c - '0');
+	if (c >= 'a' && c <= 'f')
+		return (c - 'a' + 10);
+	if (c >= 'A' && c <= 'F')
+		return (c - 'A' + 10);
+	return (-1);
+}
+
+static boolean_t
+cavp_hex2bin(const char *hex, uint8_t *out, size_t *outlen)
+{
+	size_t len = strlen(hex);
+
+	if ((len & 1) != 0 || len / 2 > CAVP_FIELD_MAX)
+		return (B_FALSE);
+	for (size_t i = 0; i < len; i += 2) {
+		int hi = cavp_hexval(hex[i]), lo = cavp_hexval(hex[i + 1]);
+
+		if (hi < 0 || lo < 0)
+			return (B_FALSE);
+		out[i / 2] = (hi << 4) | lo;
+	}
+	*outlen = len / 2;
+
+	return (B_TRUE);
+}
+
+static char *
+cavp_trim(char *s)
+{
+	char *e;
+
+	while (*s == ' ' || *s == '\t')
+		s++;
+	e = s + strlen(s);
+	while (e > s && (e[-1] == ' ' || e[-1] == '\t' || e[-1] == '\r'))
+		e--;
+	*e = '\0';
+
+	return (s);
+}
+
+/*
+ * Validates the record assembled so far and, if it makes sense for the
+ * file's mode, appends it to the table. Returns B_FALSE for records we
+ * can't use, which get counted as malformed.
+ */
+static boolean_t
+cavp_emit(cavp_table_t *tab, const cavp_suite_t *cs, int file,
+    boolean_t encrypt, const cavp_rec_t *cr)
+{
+	cavp_vec_t *cv;
+	size_t key_len, iv_len = 0, aad_len = 0, tag_len = 0, len, total;
+	cavp_field_t in_f = encrypt ? CF_PT : CF_CT;
+	cavp_field_t out_f = encrypt ? CF_CT : CF_PT;
+	boolean_t fail = (cs->cs_mode == CAVP_GCM && cr->cr_fail);
+	uint8_t *p;
+
+	key_len = cr->cr_len[CF_KEY];
+	if (!cr->cr_present[CF_KEY] ||
+	    (key_len != 16 && key_len != 24 && key_len != 32))
+		return (B_FALSE);
+	if (!cr->cr_present[in_f] || (!fail && !cr->cr_present[out_f]))
+		return (B_FALSE);
+	len = cr->cr_len[in_f];
+	if (!fail && cr->cr_len[out_f] != len)
+		return (B_FALSE);
+
+	switch (cs->cs_mode) {
+	case CAVP_ECB:
+	case CAVP_CBC:
+		if (len % AES_BLOCK_LEN != 0)
+			return (B_FALSE);
+		/*FALLTHROUGH*/
+	case CAVP_CTR:
+		if (cs->cs_mode != CAVP_ECB) {
+			if (!cr->cr_present[CF_IV] ||
+			    cr->cr_len[CF_IV] != AES_BLOCK_LEN)
+				return (B_FALSE);
+			iv_len = AES_BLOCK_LEN;
+		}
+		if (cs->cs_mct && len != AES_BLOCK_LEN)
+			return (B_FALSE);
+		break;
+	case CAVP_GCM:
+		if (!cr->cr_present[CF_IV] || cr->cr_len[CF_IV] == 0 ||
+		    !cr->cr_present[CF_TAG] || cr->cr_len[CF_TAG] == 0 ||
+		    cr->cr_len[CF_TAG] > AES_BLOCK_LEN)
+			return (B_FALSE);
+		iv_len = cr->cr_len[CF_IV];
+		tag_len = cr->cr_len[CF_TAG];
+		aad_len = cr->cr_present[CF_AAD] ? cr->cr_len[CF_AAD] : 0;
+		break;
+	}
+
+	total = key_len + iv_len + aad_len + len + (fail ? 0 : len) + tag_len;
+	tab->ct_vecs = cavp_grow(tab->ct_vecs, &tab->ct_vecs_cap,
+	    tab->ct_nvecs, 1, sizeof (cavp_vec_t));
+	tab->ct_data = cavp_grow(tab->ct_data, &tab->ct_data_cap,
+	    tab->ct_data_len, total, 1);
+
+	cv = &tab->ct_vecs[tab->ct_nvecs++];
+	cv->cv_off = tab->ct_data_len;
+	cv->cv_len = len;
+	cv->cv_file = file;
+	cv->cv_count = cr->cr_count;
+	cv->cv_aad_len = aad_len;
+	cv->cv_key_len = key_len;
+	cv->cv_iv_len = iv_len;
+	cv->cv_tag_len = tag_len;
+	cv->cv_flags = (encrypt ? CAVP_F_ENCRYPT : 0) |
+	    (cs->cs_mct ? CAVP_F_MCT : 0) | (fail ? CAVP_F_FAIL : 0);
+
+	p = tab->ct_data + tab->ct_data_len;
+	bcopy(cr->cr_data[CF_KEY], p, key_len);
+	p += key_len;
+	bcopy(cr->cr_data[CF_IV], p, iv_len);
+	p += iv_len;
+	bcopy(cr->cr_data[CF_AAD], p, aad_len);
+	p += aad_len;
+	bcopy(cr->cr_data[in_f], p, len);
+	p += len;
+	if (!fail) {
+		bcopy(cr->cr_data[out_f], p, len);
+		p += len;
+	}
+	bcopy(cr->cr_data[CF_TAG], p, tag_len);
+	tab->ct_data_len += total;
+
+	return (B_TRUE);
+}
+
+/*
+ * Parses one NUL-terminated .rsp file image into the table. Records are
+ * separated by blank lines, a new COUNT line or a new [section] header.
+ */
+static void
+cavp_parse(cavp_table_t *tab, const cavp_suite_t *cs, int file, char *buf,
+    cavp_stats_t *stats)
+{
+	cavp_rec_t *cr = kmem_zalloc(sizeof (*cr), KM_SLEEP);
+	int dir = (cs->cs_dir == CAVP_DIR_SECTION ? -1 :
+	    cs->cs_dir == CAVP_DIR_ENCRYPT);
+	char *line, *next;
+
+#define	CAVP_FLUSH()							\
+	do {								\
+		if (cr->cr_any) {					\
+			if (dir < 0 ||					\
+			    !cavp_emit(tab, cs, file, dir, cr))		\
+				stats->cs_malformed++;			\
+			bzero(cr, sizeof (*cr));			\
+		}							\
+	} while (0)
+
+	for (line = buf; line != NULL; line = next) {
+		char *eq, *name, *val;
+
+		if ((next = strchr(line, '\n')) != NULL)
+			*next++ = '\0';
+		line = cavp_trim(line);
+
+		if (*line == '#')
+			continue;
+		if (*line == '\0') {
+			CAVP_FLUSH();
+			continue;
+		}
+		if (*line == '[') {
+			CAVP_FLUSH();
+			if (cs->cs_dir != CAVP_DIR_SECTION)
+				continue;
+			if (strcmp(line, "[ENCRYPT]") == 0)
+				dir = B_TRUE;
+			else if (strcmp(line, "[DECRYPT]") == 0)
+				dir = B_FALSE;
+			continue;
+		}
+		if (strcmp(line, "FAIL") == 0) {
+			cr->cr_fail = B_TRUE;
+			cr->cr_any = B_TRUE;
+			continue;
+		}
+		if ((eq = strchr(line, '=')) == NULL)
+			continue;
+		*eq = '\0';
+		name = cavp_trim(line);
+		val = cavp_trim(eq + 1);
+
+		if (strcmp(name, "COUNT") == 0 || strcmp(name, "Count") == 0) {
+			int count = 0;
+
+			CAVP_FLUSH();
+			while (*val >= '0' && *val <= '9')
+				count = count * 10 + (*val++ - '0');
+			cr->cr_count = count;
+			cr->cr_any = B_TRUE;
+			continue;
+		}
+		for (int i = 0; i < ARRAY_SIZE(cavp_field_names); i++) {
+			cavp_field_t f = cavp_field_names[i].field;
+
+			if (strcmp(name, cavp_field_names[i].name) != 0)
+				continue;
+			if (cavp_hex2bin(val, cr->cr_data[f], &cr->cr_len[f]))
+				cr->cr_present[f] = B_TRUE;
+			else
+				stats->cs_malformed++;
+			cr->cr_any = B_TRUE;
+			break;
+		}
+	}
+	CAVP_FLUSH();
+#undef	CAVP_FLUSH
+
+	kmem_free(cr, sizeof (*cr));
+}
+
+static boolean_t
+cavp_load_file(cavp_table_t *tab, const cavp_suite_t *cs, int file,
+    cavp_stats_t *stats)
+{
+	struct _buf *fp;
+	uint64_t size;
+	char *buf;
+	int n;
+
+	if ((fp = kobj_open_file(tab->ct_files[file])) == (struct _buf *)-1)
+		return (B_FALSE);
+	if (kobj_get_filesize(fp, &size) != 0 || size > UINT32_MAX) {
+		kobj_close_file(fp);
+		return (B_FALSE);
+	}
+	buf = kmem_alloc(size + 1, KM_SLEEP);
+	n = kobj_read_file(fp, buf, size, 0);
+	kobj_close_file(fp);
+	if (n < 0 || n != size) {
+		cmn_err(CE_WARN, "CAVP: %s: short read", tab->ct_files[file]);
+		kmem_free(buf, size + 1);
+		return (B_FALSE);
+	}
+	buf[size] = '\0';
+	cavp_parse(tab, cs, file, buf, stats);
+	kmem_free(buf, size + 1);
+
+	return (B_TRUE);
+}
+
+static void
+cavp_report(const cavp_table_t *tab, const cavp_vec_t *cv,
+    cavp_stats_t *stats, const char *why, int rv)
+{
+	if (atomic_inc_32_nv(&stats->cs_reported) > CAVP_MAX_REPORT)
+		return;
+	cmn_err(CE_WARN, "CAVP %s COUNT=%d %s: BAD (%s, rv=%x)",
+	    tab->ct_files[cv->cv_file], cv->cv_count,
+	    (cv->cv_flags & CAVP_F_ENCRYPT) ? "E" : "D", why, rv);
+}
+
+/*
+ * Runs the AESAVS MCT inner loop for ECB or CBC. For ECB each output
+ * becomes the next input. For CBC the first next input is the IV and
+ * after that it's the output from two iterations back; the context
+ * does the chaining. The same recurrence holds in both directions.
+ */
+static int
+cavp_run_mct(crypto_context_t ctx, boolean_t encrypt, cavp_mode_t mode,
+    const uint8_t *iv, const uint8_t *in, uint8_t *out)
+{
+	uint8_t cur[AES_BLOCK_LEN], prev[AES_BLOCK_LEN];
+	size_t off;
+	int rv;
+
+	bcopy(in, cur, AES_BLOCK_LEN);
+	for (int j = 0; j < CAVP_MCT_ITER; j++) {
+		off = 0;
+		rv = crypt_update(ctx, encrypt, cur, AES_BLOCK_LEN, out,
+		    AES_BLOCK_LEN, &off);
+		if (rv != CRYPTO_SUCCESS)
+			return (rv);
+		if (off != AES_BLOCK_LEN) {
+			/* provider held the block back, can't chain */
+			crypto_cancel_ctx(ctx);
+			return (CRYPTO_DATA_LEN_RANGE);
+		}
+		if (mode == CAVP_CBC)
+			bcopy(j == 0 ? iv : prev, cur, AES_BLOCK_LEN);
+		else
+			bcopy(out, cur, AES_BLOCK_LEN);
+		bcopy(out, prev, AES_BLOCK_LEN);
+	}
+	off = 0;
+
+	return (crypt_final(ctx, encrypt, out, AES_BLOCK_LEN, &off));
+}
+
+static void
+cavp_run_vec(const cavp_table_t *tab, const cavp_vec_t *cv,
+    cavp_stats_t *stats)
+{
+	cavp_mode_t mode = tab->ct_modes[cv->cv_file];
+	boolean_t encrypt = (cv->cv_flags & CAVP_F_ENCRYPT) != 0;
+	boolean_t fail = (cv->cv_flags & CAVP_F_FAIL) != 0;
+	uint8_t inbuf[CAVP_FIELD_MAX + AES_BLOCK_LEN];
+	uint8_t outbuf[CAVP_FIELD_MAX + AES_BLOCK_LEN];
+	const uint8_t *in = CV_IN(tab, cv);
+	size_t in_len = cv->cv_len, out_len = cv->cv_len, off = 0;
+	CK_AES_CTR_PARAMS ctr_params;
+	CK_AES_GCM_PARAMS gcm_params;
+	crypto_mechanism_t mech;
+	crypto_context_t ctx;
+	crypto_key_t kcf_key;
+	int rv;
+
+	CRYPTO_SET_RAW_KEY(kcf_key, CV_KEY(tab, cv), cv->cv_key_len);
+	switch (mode) {
+	case CAVP_ECB:
+		mech.cm_type = crypto_mech2id(SUN_CKM_AES_ECB);
+		mech.cm_param = NULL;
+		mech.cm_param_len = 0;
+		break;
+	case CAVP_CBC:
+		mech.cm_type = crypto_mech2id(SUN_CKM_AES_CBC);
+		mech.cm_param = (void *)CV_IV(tab, cv);
+		mech.cm_param_len = AES_BLOCK_LEN;
+		break;
+	case CAVP_CTR:
+		ctr_params.ulCounterBits = 128;
+		bcopy(CV_IV(tab, cv), ctr_params.cb, AES_BLOCK_LEN);
+		mech.cm_type = crypto_mech2id(SUN_CKM_AES_CTR);
+		mech.cm_param = (void *)&ctr_params;
+		mech.cm_param_len = sizeof (ctr_params);
+		break;
+	case CAVP_GCM:
+		GCM_PARAM_SET(gcm_params, CV_IV(tab, cv), cv->cv_iv_len,
+		    CV_AAD(tab, cv), cv->cv_aad_len, cv->cv_tag_len);
+		mech.cm_type = crypto_mech2id(SUN_CKM_AES_GCM);
+		mech.cm_param = (void *)&gcm_params;
+		mech.cm_param_len = sizeof (gcm_params);
+		if (encrypt) {
+			out_len += cv->cv_tag_len;
+		} else {
+			/* the tag rides at the end of the ciphertext */
+			bcopy(in, inbuf, cv->cv_len);
+			bcopy(CV_TAG(tab, cv), inbuf + cv->cv_len,
+			    cv->cv_tag_len);
+			in = inbuf;
+			in_len += cv->cv_tag_len;
+		}
+		break;
+	}
+
+	if (encrypt)
+		rv = crypto_encrypt_init(&mech, &kcf_key, NULL, &ctx, NULL);
+	else
+		rv = crypto_decrypt_init(&mech, &kcf_key, NULL, &ctx, NULL);
+	if (rv != CRYPTO_SUCCESS) {
+		cavp_report(tab, cv, stats, "init", rv);
+		goto bad;
+	}
+
+	if (cv->cv_flags & CAVP_F_MCT) {
+		atomic_inc_64(&stats->cs_nmct);
+		rv = cavp_run_mct(ctx, encrypt, mode, CV_IV(tab, cv), in,
+		    outbuf);
+		off = AES_BLOCK_LEN;
+	} else {
+		if (in_len > 0) {
+			rv = crypt_update(ctx, encrypt, in, in_len, outbuf,
+			    out_len, &off);
+			if (rv != CRYPTO_SUCCESS) {
+				cavp_report(tab, cv, stats, "update", rv);
+				goto bad;
+			}
+		}
+		rv = crypt_final(ctx, encrypt, outbuf, out_len, &off);
+	}
+
+	if (fail) {
+		if (rv == CRYPTO_INVALID_MAC)
+			goto good;
+		cavp_report(tab, cv, stats, "forged tag accepted", rv);
+		goto bad;
+	}
+	if (rv != CRYPTO_SUCCESS) {
+		cavp_report(tab, cv, stats, "final", rv);
+		goto bad;
+	}
+	if (off != out_len || bcmp(outbuf, CV_OUT(tab, cv), cv->cv_len) != 0 ||
+	    (mode == CAVP_GCM && encrypt && bcmp(outbuf + cv->cv_len,
+	    CV_TAG(tab, cv), cv->cv_tag_len) != 0)) {
+		cavp_report(tab, cv, stats, "mismatch", rv);
+		goto bad;
+	}
+good:
+	atomic_inc_64(&stats->cs_passed);
+	return;
+bad:
+	atomic_inc_64(&stats->cs_failed);
+}
+
+static void
+cavp_task(void *arg)
+{
+	cavp_task_t *tk = arg;
+	const cavp_table_t *tab = tk->tk_tab;
+
+	for (size_t i = tk->tk_first; i < tab->ct_nvecs; i += tk->tk_stride)
+		cavp_run_vec(tab, &tab->ct_vecs[i], tk->tk_stats);
+}
+
+void
+test_cavp_all(void)
+{
+	cavp_table_t tab;
+	cavp_stats_t stats;
+	cavp_task_t *tasks;
+	taskq_t *tq;
+	int ntasks, file;
+	hrtime_t start, loaded, end;
+
+	bzero(&tab, sizeof (tab));
+	bzero(&stats, sizeof (stats));
+
+	start = gethrtime();
+	file = 0;
+	for (int i = 0; i < ARRAY_SIZE(cavp_suites); i++) {
+		for (int j = 0; j < ARRAY_SIZE(cavp_keybits); j++, file++) {
+			tab.ct_files[file] = kmem_asprintf("%s/%s%d.rsp",
+			    crypto_test_cavp_dir, cavp_suites[i].cs_prefix,
+			    cavp_keybits[j]);
+			tab.ct_modes[file] = cavp_suites[i].cs_mode;
+			if (cavp_load_file(&tab, &cavp_suites[i], file, &stats))
+				stats.cs_nfiles++;
+			else
+				stats.cs_missing++;
+		}
+	}
+	loaded = gethrtime();
+
+	if (tab.ct_nvecs == 0) {
+		cmn_err(CE_NOTE, "CAVP: no vectors found in %s, skipping",
+		    crypto_test_cavp_dir);
+		goto out;
+	}
+
+	ntasks = ncpus * CAVP_TASKS_PER_CPU;
+	tasks = kmem_zalloc(ntasks * sizeof (*tasks), KM_SLEEP);
+	tq = taskq_create("crypto_test_cavp", ncpus, minclsyspri, ncpus,
+	    INT_MAX, TASKQ_PREPOPULATE);
+	for (int i = 0; i < ntasks; i++) {
+		tasks[i].tk_tab = &tab;
+		tasks[i].tk_stats = &stats;
+		tasks[i].tk_first = i;
+		tasks[i].tk_stride = ntasks;
+		(void) taskq_dispatch(tq, cavp_task, &tasks[i], TQ_SLEEP);
+	}
+	taskq_wait(tq);
+	taskq_destroy(tq);
+	kmem_free(tasks, ntasks * sizeof (*tasks));
+	end = gethrtime();
+
+	cmn_err(CE_NOTE, "CAVP: %d files (%d missing), %llu vectors "
+	    "(%llu MCT), %llu KiB table, loaded in %llu ms",
+	    stats.cs_nfiles, stats.cs_missing,
+	    (unsigned long long)tab.ct_nvecs,
+	    (unsigned long long)stats.cs_nmct,
+	    (unsigned long long)((tab.ct_nvecs * sizeof (cavp_vec_t) +
+	    tab.ct_data_len) >> 10),
+	    (unsigned long long)(loaded - start) / (NANOSEC / MILLISEC));
+	if (stats.cs_malformed != 0) {
+		cmn_err(CE_WARN, "CAVP: %llu malformed records skipped",
+		    (unsigned long long)stats.cs_malformed);
+	}
+	cmn_err(CE_NOTE, "CAVP: %s: %llu passed, %llu failed in %llu ms "
+	    "on %d CPUs", stats.cs_failed == 0 ? "OK" : "BAD",
+	    (unsigned long long)stats.cs_passed,
+	    (unsigned long long)stats.cs_failed,
+	    (unsigned long long)(end - loaded) / (NANOSEC / MILLISEC), ncpus);
+
+out:
+	cavp_table_free(&tab);
+}
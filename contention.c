@@ -0,0 +1,258 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://opensource.org/licenses/CDDL-1.0
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+/*
+ * Copyright 2014 by Saso Kiselkov. All rights reserved.
+ */
+
+/*
+ * Shared-key contention benchmark. N unbound threads encrypt short
+ * messages (crypto_test_contend_msglen bytes) under one key in tight
+ * init/update/final cycles, first with every init doing its own key
+ * schedule and then sharing one context template. N steps through the
+ * powers of two up to crypto_test_contend_threads (0 means ncpus).
+ *
+ * For each step we report the aggregate rate and the average and worst
+ * latency of each phase, with the average init time also given relative
+ * to the single-thread run. Init is where the framework picks a provider
+ * and allocates the context, final is where it's torn down, so a phase
+ * that grows with N while the others stay flat is a serialization point.
+ *
+ * The framework and provider locks themselves can't be observed from in
+ * here; run the module under lockstat(1M) for that, e.g.
+ *
+ *	# lockstat -kWP -D 20 modload debug64/crypto_test
+ *
+ * for contention events by caller, or with -H for hold times.
+ */
+
+#include <sys/types.h>
+#include <sys/cmn_err.h>
+#include <sys/ddi.h>
+#include <sys/sunddi.h>
+#include <sys/cpuvar.h>
+#include <sys/time.h>
+#include <sys/systm.h>
+#include <sys/sysmacros.h>
+#include <sys/crypto/common.h>
+#include <sys/crypto/api.h>
+
+#include "crypto_test.h"
+
+#define	CONTEND_INIT	0
+#define	CONTEND_UPDATE	1
+#define	CONTEND_FINAL	2
+#define	CONTEND_NPHASES	3
+
+int crypto_test_contend_threads = 0;
+int crypto_test_contend_msglen = 512;
+
+typedef struct contend_phase {
+	uint64_t	cp_sum;
+	uint64_t	cp_max;
+} contend_phase_t;
+
+typedef struct contend_run {
+	workers_t		cr_workers;
+	const char		*cr_mech_name;
+	crypto_mechanism_t	*cr_mech;
+	crypto_key_t		*cr_key;
+	crypto_ctx_template_t	cr_tmpl;
+	size_t			cr_msglen;
+} contend_run_t;
+
+typedef struct contend_worker {
+	contend_run_t	*cw_run;
+	int		cw_rv;
+	uint64_t	cw_cycles;
+	contend_phase_t	cw_phase[CONTEND_NPHASES];
+} contend_worker_t;
+
+static const char *contend_phase_names[CONTEND_NPHASES] = {
+	"init", "update", "final"
+};
+
+static void
+contend_account(contend_phase_t *cp, hrtime_t start, hrtime_t end)
+{
+	uint64_t t = end - start;
+
+	cp->cp_sum += t;
+	if (t > cp->cp_max)
+		cp->cp_max = t;
+}
+
+static void
+contend_worker(void *arg)
+{
+	contend_worker_t *cw = arg;
+	contend_run_t *cr = cw->cw_run;
+	size_t out_len = cr->cr_msglen + AES_BLOCK_LEN;
+	uint8_t *in = kmem_zalloc(cr->cr_msglen, KM_SLEEP);
+	uint8_t *out = kmem_zalloc(out_len, KM_SLEEP);
+	crypto_context_t ctx;
+	hrtime_t deadline, t0, t1, t2, t3;
+	int rv = CRYPTO_SUCCESS;
+
+	deadline = workers_sync(&cr->cr_workers) + SPEED_TEST_TIME * NANOSEC;
+
+	do {
+		size_t off = 0;
+
+		t0 = gethrtime();
+		rv = crypt_init(cr->cr_mech_name, cr->cr_mech, cr->cr_key,
+		    cr->cr_tmpl, B_TRUE, &ctx);
+		t1 = gethrtime();
+		if (rv != CRYPTO_SUCCESS)
+			break;
+		rv = crypt_update(ctx, B_TRUE, in, cr->cr_msglen, out,
+		    out_len, &off);
+		t2 = gethrtime();
+		if (rv != CRYPTO_SUCCESS)
+			break;
+		rv = crypt_final(ctx, B_TRUE, out, out_len, &off);
+		t3 = gethrtime();
+		if (rv != CRYPTO_SUCCESS)
+			break;
+
+		contend_account(&cw->cw_phase[CONTEND_INIT], t0, t1);
+		contend_account(&cw->cw_phase[CONTEND_UPDATE], t1, t2);
+		contend_account(&cw->cw_phase[CONTEND_FINAL], t2, t3);
+		cw->cw_cycles++;
+	} while (t3 < deadline);
+
+	kmem_free(in, cr->cr_msglen);
+	kmem_free(out, out_len);
+	cw->cw_rv = rv;
+}
+
+/*
+ * Runs `nthreads' workers for SPEED_TEST_TIME seconds and sums their
+ * statistics into `*total'. Returns B_FALSE if any of them failed.
+ */
+static boolean_t
+contend_run(contend_run_t *cr, int nthreads, contend_worker_t *total)
+{
+	contend_worker_t *cw = kmem_zalloc(nthreads * sizeof (*cw), KM_SLEEP);
+	boolean_t failed = B_FALSE;
+
+	for (int i = 0; i < nthreads; i++)
+		cw[i].cw_run = cr;
+	workers_start(&cr->cr_workers, nthreads, contend_worker, cw,
+	    sizeof (*cw));
+	workers_go(&cr->cr_workers);
+	workers_wait(&cr->cr_workers);
+
+	bzero(total, sizeof (*total));
+	for (int i = 0; i < nthreads; i++) {
+		if (cw[i].cw_rv != CRYPTO_SUCCESS && !failed) {
+			failed = B_TRUE;
+			cmn_err(CE_WARN, "Contention worker problem: %x",
+			    cw[i].cw_rv);
+		}
+		total->cw_cycles += cw[i].cw_cycles;
+		for (int p = 0; p < CONTEND_NPHASES; p++) {
+			contend_phase_t *tp = &total->cw_phase[p];
+
+			tp->cp_sum += cw[i].cw_phase[p].cp_sum;
+			tp->cp_max = MAX(tp->cp_max, cw[i].cw_phase[p].cp_max);
+		}
+	}
+	kmem_free(cw, nthreads * sizeof (*cw));
+
+	return (!failed && total->cw_cycles != 0);
+}
+
+static void
+contend_test(contend_run_t *cr, const char *mech_name, int max_threads)
+{
+	uint64_t init_base = 0;
+
+	for (int n = 1; n <= max_threads; n = (n == max_threads ? n + 1 :
+	    MIN(n * 2, max_threads))) {
+		contend_worker_t total;
+		uint64_t avg[CONTEND_NPHASES];
+		uint64_t ops;
+
+		if (!contend_run(cr, n, &total))
+			return;
+		ops = total.cw_cycles / SPEED_TEST_TIME;
+		for (int p = 0; p < CONTEND_NPHASES; p++)
+			avg[p] = total.cw_phase[p].cp_sum / total.cw_cycles;
+		if (n == 1)
+			init_base = MAX(avg[CONTEND_INIT], 1);
+
+		cmn_err(CE_NOTE, "C[%s%s] %d threads: %llu ops/s, %llu MB/s, "
+		    "init %llu%% of 1 thread", mech_name,
+		    cr->cr_tmpl != NULL ? ", tmpl" : "", n,
+		    (unsigned long long)ops,
+		    (unsigned long long)(ops * cr->cr_msglen) >> 20,
+		    (unsigned long long)(avg[CONTEND_INIT] * 100 / init_base));
+		for (int p = 0; p < CONTEND_NPHASES; p++) {
+			cmn_err(CE_NOTE, "C[%s%s] %d threads: %s avg %llu ns, "
+			    "max %llu ns", mech_name,
+			    cr->cr_tmpl != NULL ? ", tmpl" : "", n,
+			    contend_phase_names[p], (unsigned long long)avg[p],
+			    (unsigned long long)total.cw_phase[p].cp_max);
+		}
+	}
+}
+
+void
+speed_test_contention(void)
+{
+	int max_threads = crypto_test_contend_threads > 0 ?
+	    crypto_test_contend_threads : ncpus;
+	uint8_t K[16], iv[AES_BLOCK_LEN];
+	contend_run_t cr;
+
+	bzero(K, sizeof (K));
+	bzero(iv, sizeof (iv));
+	bzero(&cr, sizeof (cr));
+	cr.cr_msglen = P2ROUNDUP(MAX(crypto_test_contend_msglen, 1),
+	    AES_BLOCK_LEN);
+
+	for (int i = 0; i < ARRAY_SIZE(aes_mechs); i++) {
+		crypto_mechanism_t mech;
+		mech_params_t mp;
+		crypto_key_t kcf_key;
+		int rv;
+
+		CRYPTO_SET_RAW_KEY(kcf_key, K, sizeof (K));
+		mech_setup(&mech, &mp, aes_mechs[i], iv, 12, NULL, 0,
+		    AES_BLOCK_LEN);
+		cr.cr_mech_name = aes_mechs[i];
+		cr.cr_mech = &mech;
+		cr.cr_key = &kcf_key;
+
+		cr.cr_tmpl = NULL;
+		contend_test(&cr, aes_mechs[i], max_threads);
+
+		rv = crypto_create_ctx_template(&mech, &kcf_key, &cr.cr_tmpl,
+		    KM_SLEEP);
+		if (rv != CRYPTO_SUCCESS) {
+			cmn_err(CE_NOTE, "C[%s]: no context template: %x",
+			    aes_mechs[i], rv);
+			continue;
+		}
+		contend_test(&cr, aes_mechs[i], max_threads);
+		crypto_destroy_ctx_template(cr.cr_tmpl);
+	}
+}
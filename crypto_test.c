@@ -31,41 +31,21 @@
 #include <sys/strsun.h>
 #include <sys/systm.h>
 #include <sys/sysmacros.h>
+#include <sys/random.h>
+#include <sys/sdt.h>
+#include <sys/thread.h>
+#include <sys/proc.h>
+#include <sys/disp.h>
+#include <sys/time.h>
 
-#define	CHECK
+#include "crypto_test.h"
 
-#define	SPEED_TEST_TIME	3
-
-#define	ENCBLKSZ	(128 * 1024)
-#define	ROUNDS		48
-#define	CRYPTO_SET_RAW_DATA(obj, d, l)		\
-	do {					\
-		obj.cd_format = CRYPTO_DATA_RAW;\
-		obj.cd_miscdata = NULL;		\
-		obj.cd_length = l;		\
-		obj.cd_offset = 0;		\
-		obj.cd_raw.iov_base = (void *)d;\
-		obj.cd_raw.iov_len = l;		\
-	} while (0)
-#define	CRYPTO_SET_RAW_KEY(obj, k, l)			\
-	do {						\
-		obj.ck_format = CRYPTO_KEY_RAW;		\
-		obj.ck_data = (void *)k;		\
-		obj.ck_length = CRYPTO_BYTES2BITS(l);	\
-	} while (0)
-#define	GCM_PARAM_SET(param, iv, iv_len, AAD, AAD_len, tag_len)		\
-	do {								\
-		param.pIv = iv;						\
-		param.ulIvLen = iv_len;					\
-		param.ulIvBits = CRYPTO_BYTES2BITS(iv_len);		\
-		param.pAAD = AAD;					\
-		param.ulAADLen = AAD_len;				\
-		param.ulTagBits = CRYPTO_BYTES2BITS(tag_len);		\
-	} while (0)
-
-#define	AES_BLOCK(x) \
-	(unsigned long long) ntohll(((uint64_t *)x)[0]), \
-	(unsigned long long) ntohll(((uint64_t *)x)[1])
+#define	CHECK
+/* #define	TIMING */
+/* #define	BUFFERS */
+/* #define	PLACEMENT */
+/* #define	CONTENTION */
+/* #define	SOAK */
 
 #define	ECB_NCOPIES	16
 
@@ -74,6 +54,18 @@ static struct modlinkage modlinkage = {
 	.ml_linkage =	{ NULL }
 };
 
+const char *const aes_mechs[AES_NMECHS] = {
+	SUN_CKM_AES_GCM,
+	SUN_CKM_AES_CBC,
+	SUN_CKM_AES_CTR,
+	SUN_CKM_AES_ECB
+};
+
+typedef struct worker_thread {
+	workers_t	*wt_workers;
+	void		*wt_arg;
+} worker_thread_t;
+
 static void speed_test(const char *mech_name, boolean_t encrypt);
 static void test_ecb_all(void);
 static void test_cbc_all(void);
@@ -454,15 +446,32 @@ _init(void)
 	test_cbc_all();
 	test_ctr_all();
 	test_gcm_all();
+	test_cavp_all();
+	test_split_all();
+	test_ctr_boundaries();
 #else
 	speed_test(SUN_CKM_AES_GCM, B_TRUE);
 	speed_test(SUN_CKM_AES_CBC, B_TRUE);
 	speed_test(SUN_CKM_AES_CTR, B_TRUE);
 	speed_test(SUN_CKM_AES_ECB, B_TRUE);
-	speed_test(SUN_CKM_AES_GCM, B_FALSE);
-	speed_test(SUN_CKM_AES_CBC, B_FALSE);
-	speed_test(SUN_CKM_AES_CTR, B_FALSE);
-	speed_test(SUN_CKM_AES_ECB, B_FALSE);
+	speed_test_decrypt();
+	speed_test_split();
+	speed_test_ctr_stream();
+#endif
+#ifdef TIMING
+	test_timing_all();
+#endif
+#ifdef BUFFERS
+	speed_test_buffers();
+#endif
+#ifdef PLACEMENT
+	speed_test_placement();
+#endif
+#ifdef CONTENTION
+	speed_test_contention();
+#endif
+#ifdef SOAK
+	test_soak();
 #endif
 
 	return (EACCES);
@@ -470,11 +479,42 @@ _init(void)
 
 static void
 speed_test(const char *mech_name, boolean_t encrypt)
+{
+	uint8_t *input, *output;
+	uint64_t rate;
+
+	DTRACE_PROBE3(crypto_test__bufs__start, int, -1, size_t,
+	    ENCBLKSZ + SPEED_OUTLEN, kthread_t *, curthread);
+	input = kmem_zalloc(ENCBLKSZ, KM_SLEEP);
+	output = kmem_zalloc(SPEED_OUTLEN, KM_SLEEP);
+	DTRACE_PROBE3(crypto_test__bufs__done, int, -1, boolean_t, B_TRUE,
+	    kthread_t *, curthread);
+
+	rate = speed_run(mech_name, encrypt, input, output, NULL);
+	if (rate != 0) {
+		cmn_err(CE_NOTE, "%s[%s]: %llu MB/s", encrypt ? "E" : "D",
+		    mech_name, (long long unsigned) rate >> 20);
+	}
+
+	kmem_free(input, ENCBLKSZ);
+	kmem_free(output, SPEED_OUTLEN);
+}
+
+/*
+ * Runs the speed test loop on caller-supplied buffers of ENCBLKSZ and
+ * SPEED_OUTLEN bytes. Each round's output lands after the previous one,
+ * so the whole output buffer gets streamed through. Returns the rate in
+ * bytes/s (0 on failure) and the total byte count in `*processedp'.
+ * Decrypting here only makes sense for the unauthenticated modes, as
+ * the input isn't real ciphertext; speed_test_decrypt() does it right.
+ */
+uint64_t
+speed_run(const char *mech_name, boolean_t encrypt, uint8_t *input,
+    uint8_t *output, uint64_t *processedp)
 {
 	int ret;
 	uint8_t K[16];
-	uint8_t token[16], iv[16];
-	crypto_data_t kcf_input, kcf_output, kcf_token;
+	uint8_t iv[16];
 	CK_AES_GCM_PARAMS gcm_params = { iv, 12, 12 * 8, NULL, 0, 128 };
 	CK_AES_CTR_PARAMS ctr_params = {
 	    64, {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0}
@@ -484,12 +524,9 @@ speed_test(const char *mech_name, boolean_t encrypt)
 	    .ck_data = (void *)K,
 	    .ck_length = CRYPTO_BYTES2BITS(sizeof (K))
 	};
-	uint8_t *input = kmem_zalloc(ENCBLKSZ, KM_SLEEP);
-	uint8_t *output = kmem_zalloc(ROUNDS * ENCBLKSZ + 16, KM_SLEEP);
 	crypto_mechanism_t mech;
 	crypto_context_t ctx;
 	clock_t start, end;
-	boolean_t first_block = B_TRUE;
 	uint64_t processed = 0;
 
 	if (strcmp(mech_name, SUN_CKM_AES_GCM) == 0) {
@@ -511,45 +548,29 @@ speed_test(const char *mech_name, boolean_t encrypt)
 	}
 
 	bzero(K, sizeof (K));
-	bzero(token, sizeof (token));
 	bzero(iv, sizeof (iv));
 
+	DTRACE_PROBE3(crypto_test__run__start, char *, mech_name,
+	    boolean_t, encrypt, kthread_t *, curthread);
 	start = ddi_get_lbolt();
 	for (;;) {
-		if (encrypt)
-			ret = crypto_encrypt_init(&mech, &kcf_K, NULL, &ctx,
-			    NULL);
-		else
-			ret = crypto_decrypt_init(&mech, &kcf_K, NULL, &ctx,
-			    NULL);
+		size_t off = 0;
+
+		ret = crypt_init(mech_name, &mech, &kcf_K, NULL, encrypt, &ctx);
 		if (ret != CRYPTO_SUCCESS) {
 			cmn_err(CE_NOTE, "Init problem: %x", ret);
 			goto out;
 		}
 
-		CRYPTO_SET_RAW_DATA(kcf_input, input, ENCBLKSZ);
-
 		for (int i = 0; i < ROUNDS; i++) {
-			CRYPTO_SET_RAW_DATA(kcf_output, output,
-			    ROUNDS * ENCBLKSZ + 16);
-			if (encrypt)
-				ret = crypto_encrypt_update(ctx, &kcf_input,
-				    &kcf_output, NULL);
-			else
-				ret = crypto_decrypt_update(ctx, &kcf_input,
-				    &kcf_output, NULL);
+			ret = crypt_update(ctx, encrypt, input, ENCBLKSZ,
+			    output, SPEED_OUTLEN, &off);
 			if (ret != CRYPTO_SUCCESS) {
 				cmn_err(CE_NOTE, "Update problem: %x", ret);
 				goto out;
 			}
 		}
-		CRYPTO_SET_RAW_DATA(kcf_output, output,
-		    ROUNDS * ENCBLKSZ + 16);
-
-		if (encrypt)
-			ret = crypto_encrypt_final(ctx, &kcf_output, NULL);
-		else
-			ret = crypto_encrypt_final(ctx, &kcf_output, NULL);
+		ret = crypt_final(ctx, encrypt, output, SPEED_OUTLEN, &off);
 		if (ret != CRYPTO_SUCCESS) {
 			cmn_err(CE_NOTE, "Final problem: %x", ret);
 			goto out;
@@ -561,13 +582,212 @@ speed_test(const char *mech_name, boolean_t encrypt)
 		if (start + SPEED_TEST_TIME * hz < end)
 			break;
 	}
+out:
+	DTRACE_PROBE3(crypto_test__run__done, char *, mech_name,
+	    uint64_t, processed, kthread_t *, curthread);
+	if (ret != CRYPTO_SUCCESS)
+		return (0);
 
-	cmn_err(CE_NOTE, "%s[%s]: %llu MB/s", encrypt ? "E" : "D", mech_name,
-	    (long long unsigned) ((processed * hz) / (end - start)) >> 20);
+	if (processedp != NULL)
+		*processedp = processed;
 
-out:
-	kmem_free(input, ENCBLKSZ);
-	kmem_free(output, ROUNDS * ENCBLKSZ + 16);
+	return ((processed * hz) / (end - start));
+}
+
+int
+crypt_init(const char *mech_name, crypto_mechanism_t *mech, crypto_key_t *key,
+    crypto_ctx_template_t tmpl, boolean_t encrypt, crypto_context_t *ctxp)
+{
+	int rv;
+
+	DTRACE_PROBE3(crypto_test__init__start, char *, mech_name,
+	    boolean_t, encrypt, kthread_t *, curthread);
+	if (encrypt)
+		rv = crypto_encrypt_init(mech, key, tmpl, ctxp, NULL);
+	else
+		rv = crypto_decrypt_init(mech, key, tmpl, ctxp, NULL);
+	DTRACE_PROBE3(crypto_test__init__done, char *, mech_name, int, rv,
+	    kthread_t *, curthread);
+
+	return (rv);
+}
+
+int
+crypt_update(crypto_context_t ctx, boolean_t encrypt, const void *in,
+    size_t len, void *out, size_t out_len, size_t *off)
+{
+	int rv;
+	crypto_data_t kcf_input, kcf_output;
+
+	CRYPTO_SET_RAW_DATA(kcf_input, in, len);
+	CRYPTO_SET_RAW_DATA(kcf_output, out, out_len);
+	kcf_output.cd_offset = *off;
+	kcf_output.cd_length = out_len - *off;
+
+	DTRACE_PROBE3(crypto_test__update__start, crypto_context_t, ctx,
+	    size_t, len, kthread_t *, curthread);
+	if (encrypt)
+		rv = crypto_encrypt_update(ctx, &kcf_input, &kcf_output, NULL);
+	else
+		rv = crypto_decrypt_update(ctx, &kcf_input, &kcf_output, NULL);
+	DTRACE_PROBE3(crypto_test__update__done, crypto_context_t, ctx,
+	    int, rv, kthread_t *, curthread);
+	if (rv == CRYPTO_SUCCESS)
+		*off += kcf_output.cd_length;
+
+	return (rv);
+}
+
+int
+crypt_final(crypto_context_t ctx, boolean_t encrypt, void *out,
+    size_t out_len, size_t *off)
+{
+	int rv;
+	crypto_data_t kcf_output;
+
+	CRYPTO_SET_RAW_DATA(kcf_output, out, out_len);
+	kcf_output.cd_offset = *off;
+	kcf_output.cd_length = out_len - *off;
+
+	DTRACE_PROBE3(crypto_test__final__start, crypto_context_t, ctx,
+	    size_t, out_len - *off, kthread_t *, curthread);
+	if (encrypt)
+		rv = crypto_encrypt_final(ctx, &kcf_output, NULL);
+	else
+		rv = crypto_decrypt_final(ctx, &kcf_output, NULL);
+	DTRACE_PROBE3(crypto_test__final__done, crypto_context_t, ctx,
+	    int, rv, kthread_t *, curthread);
+	if (rv == CRYPTO_SUCCESS)
+		*off += kcf_output.cd_length;
+
+	return (rv);
+}
+
+const char *
+mech_short_name(const char *mech_name)
+{
+	if (strcmp(mech_name, SUN_CKM_AES_ECB) == 0)
+		return ("ECB");
+	else if (strcmp(mech_name, SUN_CKM_AES_CBC) == 0)
+		return ("CBC");
+	else if (strcmp(mech_name, SUN_CKM_AES_CTR) == 0)
+		return ("CTR");
+	else
+		return ("GCM");
+}
+
+void
+mech_setup(crypto_mechanism_t *mech, mech_params_t *mp,
+    const char *mech_name, uint8_t *iv, size_t iv_len, uint8_t *aad,
+    size_t aad_len, size_t tag_len)
+{
+	bzero(mp, sizeof (*mp));
+	mech->cm_type = crypto_mech2id((char *)mech_name);
+
+	if (strcmp(mech_name, SUN_CKM_AES_GCM) == 0) {
+		GCM_PARAM_SET(mp->mp_gcm, iv, iv_len, aad, aad_len, tag_len);
+		mech->cm_param = (void *)&mp->mp_gcm;
+		mech->cm_param_len = sizeof (mp->mp_gcm);
+	} else if (strcmp(mech_name, SUN_CKM_AES_CBC) == 0) {
+		mech->cm_param = (void *)iv;
+		mech->cm_param_len = AES_BLOCK_LEN;
+	} else if (strcmp(mech_name, SUN_CKM_AES_CTR) == 0) {
+		mp->mp_ctr.ulCounterBits = 128;
+		bcopy(iv, mp->mp_ctr.cb, AES_BLOCK_LEN);
+		mech->cm_param = (void *)&mp->mp_ctr;
+		mech->cm_param_len = sizeof (mp->mp_ctr);
+	} else {
+		mech->cm_param = NULL;
+		mech->cm_param_len = 0;
+	}
+}
+
+uint32_t
+rand_below(uint32_t n)
+{
+	uint32_t r;
+
+	(void) random_get_pseudo_bytes((uint8_t *)&r, sizeof (r));
+
+	return (n == 0 ? 0 : r % n);
+}
+
+static void
+worker_thread(void *arg)
+{
+	worker_thread_t *wt = arg;
+	workers_t *wk = wt->wt_workers;
+
+	wk->wk_func(wt->wt_arg);
+
+	mutex_enter(&wk->wk_lock);
+	wk->wk_running--;
+	cv_broadcast(&wk->wk_cv);
+	mutex_exit(&wk->wk_lock);
+	thread_exit();
+}
+
+void
+workers_start(workers_t *wk, int n, void (*func)(void *), void *args,
+    size_t arg_size)
+{
+	bzero(wk, sizeof (*wk));
+	mutex_init(&wk->wk_lock, NULL, MUTEX_DEFAULT, NULL);
+	cv_init(&wk->wk_cv, NULL, CV_DEFAULT, NULL);
+	wk->wk_count = n;
+	wk->wk_running = n;
+	wk->wk_func = func;
+	wk->wk_threads = kmem_alloc(n * sizeof (worker_thread_t), KM_SLEEP);
+
+	for (int i = 0; i < n; i++) {
+		worker_thread_t *wt = &wk->wk_threads[i];
+
+		wt->wt_workers = wk;
+		wt->wt_arg = (uint8_t *)args + i * arg_size;
+		(void) thread_create(NULL, 0, worker_thread, wt, 0, &p0,
+		    TS_RUN, minclsyspri);
+	}
+}
+
+hrtime_t
+workers_sync(workers_t *wk)
+{
+	hrtime_t go_time;
+
+	mutex_enter(&wk->wk_lock);
+	wk->wk_ready++;
+	cv_broadcast(&wk->wk_cv);
+	while (!wk->wk_go)
+		cv_wait(&wk->wk_cv, &wk->wk_lock);
+	go_time = wk->wk_go_time;
+	mutex_exit(&wk->wk_lock);
+
+	return (go_time);
+}
+
+void
+workers_go(workers_t *wk)
+{
+	mutex_enter(&wk->wk_lock);
+	while (wk->wk_ready < wk->wk_count)
+		cv_wait(&wk->wk_cv, &wk->wk_lock);
+	wk->wk_go_time = gethrtime();
+	wk->wk_go = B_TRUE;
+	cv_broadcast(&wk->wk_cv);
+	mutex_exit(&wk->wk_lock);
+}
+
+void
+workers_wait(workers_t *wk)
+{
+	mutex_enter(&wk->wk_lock);
+	while (wk->wk_running > 0)
+		cv_wait(&wk->wk_cv, &wk->wk_lock);
+	mutex_exit(&wk->wk_lock);
+
+	kmem_free(wk->wk_threads, wk->wk_count * sizeof (worker_thread_t));
+	cv_destroy(&wk->wk_cv);
+	mutex_destroy(&wk->wk_lock);
 }
 
 static void
@@ -677,14 +897,7 @@ test_mode(int tcN, char *mech_name, boolean_t encrypt, void *K,
 	    .cm_param_len = param_len
 	};
 	uint8_t *inbuf, *outbuf;
-	const char *short_name;
-
-	if (strcmp(mech_name, SUN_CKM_AES_ECB) == 0)
-		short_name = "ECB";
-	else if (strcmp(mech_name, SUN_CKM_AES_CBC) == 0)
-		short_name = "CBC";
-	else
-		short_name = "CTR";
+	const char *short_name = mech_short_name(mech_name);
 
 	inbuf = kmem_zalloc(len * ncopies, KM_SLEEP);
 	outbuf = kmem_zalloc(len * ncopies, KM_SLEEP);
@@ -0,0 +1,238 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://opensource.org/licenses/CDDL-1.0
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+/*
+ * Copyright 2014 by Saso Kiselkov. All rights reserved.
+ */
+
+#ifndef	_CRYPTO_TEST_H
+#define	_CRYPTO_TEST_H
+
+#include <sys/types.h>
+#include <sys/vmem.h>
+#include <sys/lgrp.h>
+#include <sys/ksynch.h>
+#include <sys/crypto/common.h>
+#include <sys/crypto/api.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+#define	AES_BLOCK_LEN	16
+
+#define	SPEED_TEST_TIME	3
+
+#define	ENCBLKSZ	(128 * 1024)
+#define	ROUNDS		48
+#define	SPEED_OUTLEN	(ROUNDS * ENCBLKSZ + AES_BLOCK_LEN)
+
+#define	CRYPTO_SET_RAW_DATA(obj, d, l)		\
+	do {					\
+		obj.cd_format = CRYPTO_DATA_RAW;\
+		obj.cd_miscdata = NULL;		\
+		obj.cd_length = l;		\
+		obj.cd_offset = 0;		\
+		obj.cd_raw.iov_base = (void *)d;\
+		obj.cd_raw.iov_len = l;		\
+	} while (0)
+#define	CRYPTO_SET_RAW_KEY(obj, k, l)			\
+	do {						\
+		obj.ck_format = CRYPTO_KEY_RAW;		\
+		obj.ck_data = (void *)k;		\
+		obj.ck_length = CRYPTO_BYTES2BITS(l);	\
+	} while (0)
+#define	GCM_PARAM_SET(param, iv, iv_len, AAD, AAD_len, tag_len)		\
+	do {								\
+		param.pIv = iv;						\
+		param.ulIvLen = iv_len;					\
+		param.ulIvBits = CRYPTO_BYTES2BITS(iv_len);		\
+		param.pAAD = AAD;					\
+		param.ulAADLen = AAD_len;				\
+		param.ulTagBits = CRYPTO_BYTES2BITS(tag_len);		\
+	} while (0)
+
+#define	AES_BLOCK(x) \
+	(unsigned long long) ntohll(((uint64_t *)x)[0]), \
+	(unsigned long long) ntohll(((uint64_t *)x)[1])
+
+/*
+ * Parameter storage for any of the AES modes we exercise, so that
+ * mech_setup() can fill in a mechanism without the caller caring which
+ * mode it is. CTR gets a full 128-bit counter; callers wanting another
+ * width adjust mp_ctr.ulCounterBits afterwards.
+ */
+typedef struct mech_params {
+	CK_AES_CTR_PARAMS	mp_ctr;
+	CK_AES_GCM_PARAMS	mp_gcm;
+} mech_params_t;
+
+/* The AES mechanisms the multi-mode tests loop over, in report order. */
+#define	AES_NMECHS	4
+extern const char *const aes_mechs[AES_NMECHS];
+
+extern const char *mech_short_name(const char *mech_name);
+extern void mech_setup(crypto_mechanism_t *mech, mech_params_t *mp,
+    const char *mech_name, uint8_t *iv, size_t iv_len, uint8_t *aad,
+    size_t aad_len, size_t tag_len);
+extern uint32_t rand_below(uint32_t n);
+
+/*
+ * Multi-part helpers, which also fire the init, update and final SDT
+ * probes (see dtrace/). Update and final take the whole output buffer
+ * and advance `*off' by however much output the provider chose to
+ * produce, since block modes hold back partial blocks (and GCM
+ * decryption holds back everything) until a later update or the final
+ * call. On failure the framework has already released the context, so
+ * callers must not go on to call crypt_final().
+ */
+extern int crypt_init(const char *mech_name, crypto_mechanism_t *mech,
+    crypto_key_t *key, crypto_ctx_template_t tmpl, boolean_t encrypt,
+    crypto_context_t *ctxp);
+extern int crypt_update(crypto_context_t ctx, boolean_t encrypt,
+    const void *in, size_t len, void *out, size_t out_len, size_t *off);
+extern int crypt_final(crypto_context_t ctx, boolean_t encrypt,
+    void *out, size_t out_len, size_t *off);
+
+/*
+ * A group of worker threads released together. workers_start() starts
+ * `n' threads running `func', the i-th one on the i-th `arg_size' byte
+ * element of `args'. Each worker calls workers_sync() once it's set
+ * up, which blocks until the caller's workers_go() has seen all of them
+ * ready and returns the time they were released. workers_wait() waits
+ * for all of them to return and tears the group down.
+ */
+typedef struct workers {
+	kmutex_t		wk_lock;
+	kcondvar_t		wk_cv;
+	int			wk_count;
+	int			wk_ready;
+	int			wk_running;
+	boolean_t		wk_go;
+	hrtime_t		wk_go_time;
+	void			(*wk_func)(void *);
+	struct worker_thread	*wk_threads;
+} workers_t;
+
+extern void workers_start(workers_t *wk, int n, void (*func)(void *),
+    void *args, size_t arg_size);
+extern hrtime_t workers_sync(workers_t *wk);
+extern void workers_go(workers_t *wk);
+extern void workers_wait(workers_t *wk);
+
+extern uint64_t speed_run(const char *mech_name, boolean_t encrypt,
+    uint8_t *input, uint8_t *output, uint64_t *processedp);
+
+/* cavp.c */
+extern char *crypto_test_cavp_dir;
+extern void test_cavp_all(void);
+
+/* split.c */
+extern void test_split_all(void);
+extern void speed_test_split(void);
+
+/* ctr.c */
+extern int crypto_test_ctr_stream_mb;
+extern void test_ctr_boundaries(void);
+extern void speed_test_ctr_stream(void);
+extern int ctr_ref_keystream(crypto_key_t *key, const uint8_t *block,
+    int width, size_t nblocks, uint8_t *ctrs, uint8_t *ks);
+
+/* decrypt.c */
+extern void speed_test_decrypt(void);
+
+/* timing.c */
+extern void test_timing_all(void);
+
+/* buffers.c */
+typedef enum buf_policy {
+	BUF_POLICY_BASE,
+	BUF_POLICY_LARGE,
+	BUF_POLICY_ARENA,
+	BUF_POLICY_LOCAL,
+	BUF_POLICY_REMOTE,
+	BUF_NPOLICIES
+} buf_policy_t;
+
+#define	BUF_ALL		((1 << BUF_NPOLICIES) - 1)
+
+typedef struct bench_buf {
+	uint8_t		*bb_va;
+	size_t		bb_size;
+	size_t		bb_alloc;
+	void		*bb_cookie;
+} bench_buf_t;
+
+/*
+ * Input (ENCBLKSZ) and output (SPEED_OUTLEN) buffers for speed_run(),
+ * allocated according to a buf_policy_t. bbs_mem_cpu is the CPU whose
+ * lgroup the NUMA policies allocated from and bbs_lgrp_pct how many
+ * percent of the pages landed there (-1 for the other policies).
+ * bbs_pgsize is the smallest page size the large policy got mapped with
+ * (-1 for the other policies).
+ */
+typedef struct bench_bufs {
+	buf_policy_t	bbs_policy;
+	processorid_t	bbs_mem_cpu;
+	int		bbs_lgrp_pct;
+	ssize_t		bbs_pgsize;
+	bench_buf_t	bbs_in;
+	bench_buf_t	bbs_out;
+	vmem_t		*bbs_arena;
+	void		*bbs_span;
+	size_t		bbs_span_len;
+} bench_bufs_t;
+
+extern uint_t crypto_test_buf_policies;
+extern int crypto_test_bench_cpu;
+extern boolean_t bench_bufs_alloc(bench_bufs_t *bufs, buf_policy_t policy,
+    processorid_t bench_cpu);
+extern void bench_bufs_free(bench_bufs_t *bufs);
+extern processorid_t bench_cpu(void);
+extern boolean_t bench_bind(processorid_t id, lpl_t **homep);
+extern void bench_unbind(lpl_t *home);
+extern boolean_t bench_rehome(processorid_t id, lpl_t **homep);
+extern void bench_unhome(lpl_t *home);
+extern lgrp_id_t cpu_lgrp(processorid_t id);
+extern processorid_t cpu_find_lgrp_peer(processorid_t id, boolean_t same);
+extern void speed_test_buffers(void);
+
+/* placement.c */
+extern int crypto_test_peer_cpu;
+extern void speed_test_placement(void);
+
+/* contention.c */
+extern int crypto_test_contend_threads;
+extern int crypto_test_contend_msglen;
+extern void speed_test_contention(void);
+
+/* soak.c */
+extern int crypto_test_soak_secs;
+extern int crypto_test_soak_interval;
+extern int crypto_test_soak_drift_pct;
+extern int crypto_test_soak_growth_mb;
+extern int crypto_test_soak_ctx_slack;
+extern void test_soak(void);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* _CRYPTO_TEST_H */
@@ -0,0 +1,406 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://opensource.org/licenses/CDDL-1.0
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+/*
+ * Copyright 2014 by Saso Kiselkov. All rights reserved.
+ */
+
+/*
+ * AES/CTR counter handling with 32, 64 and 128-bit counter fields. The
+ * bits of the counter block outside the field are a random nonce which
+ * must never change, while the field itself wraps to zero.
+ *
+ * test_ctr_boundaries() starts the field a little before each byte,
+ * 32-bit, 64-bit and full-width carry that fits in it and encrypts
+ * across the boundary in randomly sized updates. speed_test_ctr_stream()
+ * encrypts crypto_test_ctr_stream_mb MiB in one context (at most what
+ * the field can count without wrapping twice, about 128 GiB at 32 bits),
+ * positioned so that the field wraps in the middle of the stream, and
+ * reports the throughput before, across and after the wrap. Both check
+ * the output against a reference keystream made by ECB-encrypting
+ * counter blocks which we step ourselves (the stream test checks every
+ * CTR_VERIFY_EVERY'th chunk plus the ones next to the wrap).
+ */
+
+#include <sys/types.h>
+#include <sys/cmn_err.h>
+#include <sys/random.h>
+#include <sys/byteorder.h>
+#include <sys/ddi.h>
+#include <sys/sunddi.h>
+#include <sys/time.h>
+#include <sys/systm.h>
+#include <sys/sysmacros.h>
+#include <sys/sdt.h>
+#include <sys/crypto/common.h>
+#include <sys/crypto/api.h>
+
+#include "crypto_test.h"
+
+#define	CTR_LEAD	1024
+#define	CTR_MAXCUTS	16
+#define	CTR_VERIFY_EVERY	64
+#define	CTR_CHUNK_BLOCKS	(ENCBLKSZ / AES_BLOCK_LEN)
+
+int crypto_test_ctr_stream_mb = 4096;
+
+static const int ctr_widths[] = { 32, 64, 128 };
+static const int ctr_boundaries[] = { 8, 32, 64, 128 };
+
+/* counter block in host order, cb_hi holding the first 8 bytes */
+typedef struct ctr_cb {
+	uint64_t	cb_hi;
+	uint64_t	cb_lo;
+} ctr_cb_t;
+
+static void
+ctr_cb_bytes(const ctr_cb_t *cb, uint8_t *block)
+{
+	uint64_t hi = htonll(cb->cb_hi), lo = htonll(cb->cb_lo);
+
+	bcopy(&hi, block, sizeof (hi));
+	bcopy(&lo, block + sizeof (hi), sizeof (lo));
+}
+
+/*
+ * Advances the `width'-bit counter field of `cb' by `n', wrapping within
+ * the field the same way the provider does.
+ */
+static void
+ctr_cb_add(ctr_cb_t *cb, int width, uint64_t n)
+{
+	uint64_t mask = (width >= 64 ? UINT64_MAX : (1ULL << width) - 1);
+	uint64_t lo = cb->cb_lo + n;
+
+	if (width == 128 && lo < cb->cb_lo)
+		cb->cb_hi++;
+	cb->cb_lo = (cb->cb_lo & ~mask) | (lo & mask);
+}
+
+/*
+ * Makes a counter block with a random nonce around a `width'-bit field
+ * which is `lead' steps short of carrying out of its low `boundary' bits.
+ */
+static void
+ctr_cb_init(ctr_cb_t *cb, int width, int boundary, uint64_t lead)
+{
+	uint64_t mask = (width >= 64 ? UINT64_MAX : (1ULL << width) - 1);
+	uint64_t v = (boundary >= 64 ? 0 : 1ULL << boundary) - lead;
+
+	(void) random_get_pseudo_bytes((uint8_t *)cb, sizeof (*cb));
+	if (width == 128)
+		cb->cb_hi = (boundary == 128 ? UINT64_MAX : 0);
+	cb->cb_lo = (cb->cb_lo & ~mask) | (v & mask);
+}
+
+/*
+ * Fills `ks' with `nblocks' blocks of reference keystream starting at
+ * counter `cb', using `ctrs' as scratch space of the same size.
+ */
+static int
+ctr_keystream(crypto_key_t *key, ctr_cb_t cb, int width, size_t nblocks,
+    uint8_t *ctrs, uint8_t *ks)
+{
+	crypto_mechanism_t mech;
+	crypto_data_t kcf_in, kcf_out;
+
+	for (size_t i = 0; i < nblocks; i++) {
+		ctr_cb_bytes(&cb, ctrs + i * AES_BLOCK_LEN);
+		ctr_cb_add(&cb, width, 1);
+	}
+	mech.cm_type = crypto_mech2id(SUN_CKM_AES_ECB);
+	mech.cm_param = NULL;
+	mech.cm_param_len = 0;
+	CRYPTO_SET_RAW_DATA(kcf_in, ctrs, nblocks * AES_BLOCK_LEN);
+	CRYPTO_SET_RAW_DATA(kcf_out, ks, nblocks * AES_BLOCK_LEN);
+
+	return (crypto_encrypt(&mech, &kcf_in, key, NULL, &kcf_out, NULL));
+}
+
+/*
+ * ctr_keystream() for callers outside this file, starting at the counter
+ * block `block' as laid out in memory.
+ */
+int
+ctr_ref_keystream(crypto_key_t *key, const uint8_t *block, int width,
+    size_t nblocks, uint8_t *ctrs, uint8_t *ks)
+{
+	uint64_t hi, lo;
+	ctr_cb_t cb;
+
+	bcopy(block, &hi, sizeof (hi));
+	bcopy(block + sizeof (hi), &lo, sizeof (lo));
+	cb.cb_hi = ntohll(hi);
+	cb.cb_lo = ntohll(lo);
+
+	return (ctr_keystream(key, cb, width, nblocks, ctrs, ks));
+}
+
+static void
+ctr_mech(crypto_mechanism_t *mech, mech_params_t *mp, const ctr_cb_t *cb,
+    int width)
+{
+	uint8_t block[AES_BLOCK_LEN];
+
+	ctr_cb_bytes(cb, block);
+	mech_setup(mech, mp, SUN_CKM_AES_CTR, block, sizeof (block), NULL, 0,
+	    0);
+	mp->mp_ctr.ulCounterBits = width;
+}
+
+/*
+ * Encrypts a random message of a little over 2 * lead blocks across the
+ * boundary in random updates and compares it with the reference.
+ */
+static boolean_t
+ctr_boundary(crypto_key_t *key, int width, int boundary, uint8_t *pt,
+    uint8_t *ct, uint8_t *ctrs, uint8_t *ks)
+{
+	uint64_t lead = (boundary == 8 ? 64 : CTR_LEAD);
+	size_t len = 2 * lead * AES_BLOCK_LEN + rand_below(AES_BLOCK_LEN);
+	size_t nblocks = P2ROUNDUP(len, AES_BLOCK_LEN) / AES_BLOCK_LEN;
+	size_t pos = 0, off = 0, cuts[CTR_MAXCUTS];
+	int ncuts = 1 + rand_below(CTR_MAXCUTS);
+	crypto_mechanism_t mech;
+	mech_params_t mp;
+	crypto_context_t ctx;
+	ctr_cb_t cb;
+	boolean_t ok;
+	int rv;
+
+	ctr_cb_init(&cb, width, boundary, lead);
+	ctr_mech(&mech, &mp, &cb, width);
+	(void) random_get_pseudo_bytes(pt, len);
+	for (int i = 0; i < ncuts; i++)
+		cuts[i] = (i + 1) * len / (ncuts + 1) + rand_below(7);
+
+	rv = crypt_init(SUN_CKM_AES_CTR, &mech, key, NULL, B_TRUE, &ctx);
+	for (int i = 0; rv == CRYPTO_SUCCESS && i <= ncuts; i++) {
+		size_t end = (i < ncuts ? MIN(MAX(cuts[i], pos), len) : len);
+
+		rv = crypt_update(ctx, B_TRUE, pt + pos, end - pos, ct, len,
+		    &off);
+		pos = end;
+	}
+	if (rv == CRYPTO_SUCCESS)
+		rv = crypt_final(ctx, B_TRUE, ct, len, &off);
+	if (rv == CRYPTO_SUCCESS)
+		rv = ctr_keystream(key, cb, width, nblocks, ctrs, ks);
+	if (rv != CRYPTO_SUCCESS) {
+		cmn_err(CE_WARN, "CTR/%d: problem at the %d-bit boundary: %x",
+		    width, boundary, rv);
+		return (B_FALSE);
+	}
+
+	DTRACE_PROBE3(crypto_test__verify__start, char *, SUN_CKM_AES_CTR,
+	    size_t, len, kthread_t *, curthread);
+	for (size_t i = 0; i < len; i++)
+		ks[i] ^= pt[i];
+	ok = (off == len && bcmp(ct, ks, len) == 0);
+	DTRACE_PROBE3(crypto_test__verify__done, char *, SUN_CKM_AES_CTR,
+	    boolean_t, ok, kthread_t *, curthread);
+	if (!ok) {
+		cmn_err(CE_WARN, "CTR/%d: BAD across the %d-bit boundary, "
+		    "counter %016llx%016llx, %llu bytes of %llu", width,
+		    boundary, (unsigned long long)cb.cb_hi,
+		    (unsigned long long)cb.cb_lo, (unsigned long long)off,
+		    (unsigned long long)len);
+		return (B_FALSE);
+	}
+
+	return (B_TRUE);
+}
+
+void
+test_ctr_boundaries(void)
+{
+	size_t buflen = (2 * CTR_LEAD + 1) * AES_BLOCK_LEN;
+	uint8_t *pt = kmem_alloc(buflen, KM_SLEEP);
+	uint8_t *ct = kmem_alloc(buflen, KM_SLEEP);
+	uint8_t *ctrs = kmem_alloc(buflen, KM_SLEEP);
+	uint8_t *ks = kmem_alloc(buflen, KM_SLEEP);
+	uint8_t K[16];
+	crypto_key_t kcf_key;
+
+	(void) random_get_pseudo_bytes(K, sizeof (K));
+	CRYPTO_SET_RAW_KEY(kcf_key, K, sizeof (K));
+
+	for (int w = 0; w < ARRAY_SIZE(ctr_widths); w++) {
+		int width = ctr_widths[w];
+		int nbad = 0, nb = 0;
+
+		for (int b = 0; b < ARRAY_SIZE(ctr_boundaries) &&
+		    ctr_boundaries[b] <= width; b++, nb++) {
+			if (!ctr_boundary(&kcf_key, width, ctr_boundaries[b],
+			    pt, ct, ctrs, ks))
+				nbad++;
+		}
+		if (nbad == 0) {
+			cmn_err(CE_NOTE, "CTR/%d: OK (%d carry boundaries)",
+			    width, nb);
+		}
+	}
+
+	kmem_free(pt, buflen);
+	kmem_free(ct, buflen);
+	kmem_free(ctrs, buflen);
+	kmem_free(ks, buflen);
+}
+
+static uint64_t
+ctr_rate(uint64_t bytes, hrtime_t ns)
+{
+	return (ns == 0 ? 0 : bytes * NANOSEC / ns);
+}
+
+/*
+ * Returns the most chunks a stream can have while its counter still
+ * starts less than one full turn of a `width'-bit field before the
+ * wrap, or else the field would wrap somewhere other than chunk `wrap'.
+ */
+static uint64_t
+ctr_stream_max_chunks(int width)
+{
+	uint64_t max_wrap;
+
+	if (width >= 64)
+		return (UINT64_MAX);
+	max_wrap = ((1ULL << width) - CTR_CHUNK_BLOCKS / 2 - 1) /
+	    CTR_CHUNK_BLOCKS;
+
+	return (2 * max_wrap + 1);
+}
+
+/*
+ * Streams zeros through one context, so the output is the keystream
+ * itself, with the field wrapping half way through chunk `wrap'.
+ */
+static void
+ctr_stream(crypto_key_t *key, int width, uint64_t nchunks, uint8_t *zero,
+    uint8_t *out, uint8_t *ctrs, uint8_t *ks)
+{
+	uint64_t wrap, nverified = 0, i;
+	hrtime_t ns_before = 0, ns_wrap = 0, ns_after = 0;
+	crypto_mechanism_t mech;
+	mech_params_t mp;
+	crypto_context_t ctx;
+	ctr_cb_t cb, chunk_cb;
+	size_t off;
+	boolean_t ok = B_TRUE;
+	int rv;
+
+	nchunks = MIN(nchunks, ctr_stream_max_chunks(width));
+	wrap = nchunks / 2;
+	ctr_cb_init(&cb, width, width,
+	    wrap * CTR_CHUNK_BLOCKS + CTR_CHUNK_BLOCKS / 2);
+	ctr_mech(&mech, &mp, &cb, width);
+	chunk_cb = cb;
+
+	DTRACE_PROBE3(crypto_test__run__start, char *, SUN_CKM_AES_CTR,
+	    boolean_t, B_TRUE, kthread_t *, curthread);
+	rv = crypt_init(SUN_CKM_AES_CTR, &mech, key, NULL, B_TRUE, &ctx);
+	for (i = 0; rv == CRYPTO_SUCCESS && i < nchunks; i++) {
+		hrtime_t start, end;
+
+		off = 0;
+		start = gethrtime();
+		rv = crypt_update(ctx, B_TRUE, zero, ENCBLKSZ, out, ENCBLKSZ,
+		    &off);
+		end = gethrtime();
+		if (rv != CRYPTO_SUCCESS)
+			break;
+		if (i < wrap)
+			ns_before += end - start;
+		else if (i == wrap)
+			ns_wrap += end - start;
+		else
+			ns_after += end - start;
+
+		if (i % CTR_VERIFY_EVERY == 0 || i + 1 == nchunks ||
+		    (i + 1 >= wrap && i <= wrap + 1)) {
+			DTRACE_PROBE3(crypto_test__verify__start, char *,
+			    SUN_CKM_AES_CTR, size_t, ENCBLKSZ,
+			    kthread_t *, curthread);
+			rv = ctr_keystream(key, chunk_cb, width,
+			    CTR_CHUNK_BLOCKS, ctrs, ks);
+			ok = (rv == CRYPTO_SUCCESS && off == ENCBLKSZ &&
+			    bcmp(out, ks, ENCBLKSZ) == 0);
+			DTRACE_PROBE3(crypto_test__verify__done, char *,
+			    SUN_CKM_AES_CTR, boolean_t, ok,
+			    kthread_t *, curthread);
+			if (!ok) {
+				crypto_cancel_ctx(ctx);
+				break;
+			}
+			nverified++;
+		}
+		ctr_cb_add(&chunk_cb, width, CTR_CHUNK_BLOCKS);
+	}
+	if (rv == CRYPTO_SUCCESS && ok) {
+		off = 0;
+		rv = crypt_final(ctx, B_TRUE, out, ENCBLKSZ, &off);
+	}
+	DTRACE_PROBE3(crypto_test__run__done, char *, SUN_CKM_AES_CTR,
+	    uint64_t, nchunks * ENCBLKSZ, kthread_t *, curthread);
+	if (rv == CRYPTO_SUCCESS && !ok) {
+		cmn_err(CE_WARN, "CTR/%d: BAD stream chunk %llu of %llu "
+		    "(wrap in %llu)", width, (unsigned long long)i,
+		    (unsigned long long)nchunks, (unsigned long long)wrap);
+		return;
+	}
+	if (rv != CRYPTO_SUCCESS) {
+		cmn_err(CE_WARN, "CTR/%d: stream problem: %x", width, rv);
+		return;
+	}
+
+	cmn_err(CE_NOTE, "E[%s/%d] %llu MiB stream: %llu MB/s before wrap, "
+	    "%llu MB/s across, %llu MB/s after (%llu chunks verified)",
+	    SUN_CKM_AES_CTR, width,
+	    (unsigned long long)(nchunks * ENCBLKSZ) >> 20,
+	    (unsigned long long)ctr_rate(wrap * ENCBLKSZ, ns_before) >> 20,
+	    (unsigned long long)ctr_rate(ENCBLKSZ, ns_wrap) >> 20,
+	    (unsigned long long)ctr_rate((nchunks - wrap - 1) * ENCBLKSZ,
+	    ns_after) >> 20, (unsigned long long)nverified);
+}
+
+void
+speed_test_ctr_stream(void)
+{
+	uint64_t nchunks = MAX((uint64_t)crypto_test_ctr_stream_mb *
+	    (1024 * 1024 / ENCBLKSZ), 3);
+	uint8_t *zero = kmem_zalloc(ENCBLKSZ, KM_SLEEP);
+	uint8_t *out = kmem_alloc(ENCBLKSZ, KM_SLEEP);
+	uint8_t *ctrs = kmem_alloc(ENCBLKSZ, KM_SLEEP);
+	uint8_t *ks = kmem_alloc(ENCBLKSZ, KM_SLEEP);
+	uint8_t K[16];
+	crypto_key_t kcf_key;
+
+	(void) random_get_pseudo_bytes(K, sizeof (K));
+	CRYPTO_SET_RAW_KEY(kcf_key, K, sizeof (K));
+
+	for (int w = 0; w < ARRAY_SIZE(ctr_widths); w++)
+		ctr_stream(&kcf_key, ctr_widths[w], nchunks, zero, out, ctrs,
+		    ks);
+
+	kmem_free(zero, ENCBLKSZ);
+	kmem_free(out, ENCBLKSZ);
+	kmem_free(ctrs, ENCBLKSZ);
+	kmem_free(ks, ENCBLKSZ);
+}
@@ -0,0 +1,234 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://opensource.org/licenses/CDDL-1.0
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+/*
+ * Copyright 2014 by Saso Kiselkov. All rights reserved.
+ */
+
+/*
+ * Decryption speed test on real ciphertext. We first encrypt a corpus
+ * of ROUNDS random ENCBLKSZ-byte messages, each with its own random IV
+ * and (for GCM) AAD, keeping the tags. The timed loop then decrypts the
+ * whole corpus over and over with init/update/final, the same way the
+ * encryption speed test runs, so for GCM every message pays for its tag
+ * check. Once the time is up every decrypted message is compared with
+ * its plaintext, and for GCM a corrupted tag must be rejected.
+ */
+
+#include <sys/types.h>
+#include <sys/cmn_err.h>
+#include <sys/random.h>
+#include <sys/ddi.h>
+#include <sys/sunddi.h>
+#include <sys/systm.h>
+#include <sys/sysmacros.h>
+#include <sys/sdt.h>
+#include <sys/crypto/common.h>
+#include <sys/crypto/api.h>
+
+#include "crypto_test.h"
+
+#define	DEC_AADLEN	32
+#define	DEC_CTLEN	(ENCBLKSZ + AES_BLOCK_LEN)
+
+typedef struct dec_msg {
+	uint8_t			dm_iv[AES_BLOCK_LEN];
+	uint8_t			dm_aad[DEC_AADLEN];
+	crypto_mechanism_t	dm_mech;
+	mech_params_t		dm_mp;
+	size_t			dm_ct_len;
+	size_t			dm_out_len;
+} dec_msg_t;
+
+typedef struct dec_corpus {
+	const char	*dc_mech_name;
+	crypto_key_t	dc_key;
+	uint8_t		dc_K[16];
+	dec_msg_t	dc_msgs[ROUNDS];
+	uint8_t		*dc_pt;
+	uint8_t		*dc_ct;
+	uint8_t		*dc_out;
+} dec_corpus_t;
+
+/*
+ * Runs a single message through a fresh context into `out'.
+ */
+static int
+dec_crypt(dec_corpus_t *dc, dec_msg_t *dm, boolean_t encrypt,
+    const uint8_t *in, size_t len, uint8_t *out, size_t *out_len)
+{
+	crypto_context_t ctx;
+	int rv;
+
+	*out_len = 0;
+	rv = crypt_init(dc->dc_mech_name, &dm->dm_mech, &dc->dc_key, NULL,
+	    encrypt, &ctx);
+	if (rv != CRYPTO_SUCCESS)
+		return (rv);
+	rv = crypt_update(ctx, encrypt, in, len, out, DEC_CTLEN, out_len);
+	if (rv != CRYPTO_SUCCESS)
+		return (rv);
+
+	return (crypt_final(ctx, encrypt, out, DEC_CTLEN, out_len));
+}
+
+static boolean_t
+dec_corpus_build(dec_corpus_t *dc, const char *mech_name)
+{
+	boolean_t gcm = (strcmp(mech_name, SUN_CKM_AES_GCM) == 0);
+	int rv = CRYPTO_SUCCESS;
+
+	DTRACE_PROBE3(crypto_test__bufs__start, int, -1, size_t,
+	    ROUNDS * (ENCBLKSZ + DEC_CTLEN), kthread_t *, curthread);
+	dc->dc_mech_name = mech_name;
+	(void) random_get_pseudo_bytes(dc->dc_K, sizeof (dc->dc_K));
+	CRYPTO_SET_RAW_KEY(dc->dc_key, dc->dc_K, sizeof (dc->dc_K));
+	(void) random_get_pseudo_bytes(dc->dc_pt, ROUNDS * ENCBLKSZ);
+
+	for (int i = 0; i < ROUNDS; i++) {
+		dec_msg_t *dm = &dc->dc_msgs[i];
+
+		(void) random_get_pseudo_bytes(dm->dm_iv, sizeof (dm->dm_iv));
+		(void) random_get_pseudo_bytes(dm->dm_aad, sizeof (dm->dm_aad));
+		mech_setup(&dm->dm_mech, &dm->dm_mp, mech_name, dm->dm_iv,
+		    gcm ? 12 : sizeof (dm->dm_iv), gcm ? dm->dm_aad : NULL,
+		    gcm ? sizeof (dm->dm_aad) : 0, AES_BLOCK_LEN);
+
+		rv = dec_crypt(dc, dm, B_TRUE, dc->dc_pt + i * ENCBLKSZ,
+		    ENCBLKSZ, dc->dc_ct + i * DEC_CTLEN, &dm->dm_ct_len);
+		if (rv != CRYPTO_SUCCESS) {
+			cmn_err(CE_WARN, "D[%s]: corpus encryption problem: %x",
+			    mech_name, rv);
+			break;
+		}
+	}
+	DTRACE_PROBE3(crypto_test__bufs__done, int, -1, boolean_t,
+	    rv == CRYPTO_SUCCESS, kthread_t *, curthread);
+
+	return (rv == CRYPTO_SUCCESS);
+}
+
+/*
+ * Checks every decrypted message against its plaintext and, for GCM,
+ * that a message with a flipped tag bit no longer decrypts.
+ */
+static boolean_t
+dec_verify(dec_corpus_t *dc, const char *mech_name)
+{
+	dec_msg_t *dm = &dc->dc_msgs[0];
+	size_t out_len;
+	int rv;
+
+	for (int i = 0; i < ROUNDS; i++) {
+		if (dc->dc_msgs[i].dm_out_len != ENCBLKSZ ||
+		    bcmp(dc->dc_out + i * DEC_CTLEN, dc->dc_pt + i * ENCBLKSZ,
+		    ENCBLKSZ) != 0) {
+			cmn_err(CE_WARN, "D[%s]: message %d decrypted wrong "
+			    "(%llu bytes)", mech_name, i,
+			    (unsigned long long)dc->dc_msgs[i].dm_out_len);
+			return (B_FALSE);
+		}
+	}
+
+	if (strcmp(mech_name, SUN_CKM_AES_GCM) != 0)
+		return (B_TRUE);
+
+	dc->dc_ct[dm->dm_ct_len - 1] ^= 1;
+	rv = dec_crypt(dc, dm, B_FALSE, dc->dc_ct, dm->dm_ct_len,
+	    dc->dc_out, &out_len);
+	dc->dc_ct[dm->dm_ct_len - 1] ^= 1;
+	if (rv != CRYPTO_INVALID_MAC) {
+		cmn_err(CE_WARN, "D[%s]: corrupted tag not rejected: %x",
+		    mech_name, rv);
+		return (B_FALSE);
+	}
+
+	return (B_TRUE);
+}
+
+static void
+dec_speed(dec_corpus_t *dc, const char *mech_name)
+{
+	clock_t start, end;
+	uint64_t processed = 0;
+	boolean_t ok = B_TRUE;
+
+	if (!dec_corpus_build(dc, mech_name))
+		return;
+	bzero(dc->dc_out, ROUNDS * DEC_CTLEN);
+
+	DTRACE_PROBE3(crypto_test__run__start, char *, mech_name,
+	    boolean_t, B_FALSE, kthread_t *, curthread);
+	start = ddi_get_lbolt();
+	for (;;) {
+		for (int i = 0; i < ROUNDS; i++) {
+			dec_msg_t *dm = &dc->dc_msgs[i];
+			int rv;
+
+			rv = dec_crypt(dc, dm, B_FALSE,
+			    dc->dc_ct + i * DEC_CTLEN, dm->dm_ct_len,
+			    dc->dc_out + i * DEC_CTLEN, &dm->dm_out_len);
+			if (rv != CRYPTO_SUCCESS) {
+				cmn_err(CE_WARN, "D[%s]: message %d decryption "
+				    "problem: %x", mech_name, i, rv);
+				ok = B_FALSE;
+				break;
+			}
+		}
+		processed += ROUNDS * ENCBLKSZ;
+
+		end = ddi_get_lbolt();
+		if (!ok || start + SPEED_TEST_TIME * hz < end)
+			break;
+	}
+	DTRACE_PROBE3(crypto_test__run__done, char *, mech_name,
+	    uint64_t, processed, kthread_t *, curthread);
+	if (!ok)
+		return;
+
+	DTRACE_PROBE3(crypto_test__verify__start, char *, mech_name,
+	    size_t, ROUNDS * ENCBLKSZ, kthread_t *, curthread);
+	ok = dec_verify(dc, mech_name);
+	DTRACE_PROBE3(crypto_test__verify__done, char *, mech_name,
+	    boolean_t, ok, kthread_t *, curthread);
+	if (!ok)
+		return;
+	cmn_err(CE_NOTE, "D[%s]: %llu MB/s (%d messages verified)",
+	    mech_name, (unsigned long long)((processed * hz) /
+	    (end - start)) >> 20, ROUNDS);
+}
+
+void
+speed_test_decrypt(void)
+{
+	dec_corpus_t *dc = kmem_zalloc(sizeof (*dc), KM_SLEEP);
+
+	dc->dc_pt = kmem_alloc(ROUNDS * ENCBLKSZ, KM_SLEEP);
+	dc->dc_ct = kmem_alloc(ROUNDS * DEC_CTLEN, KM_SLEEP);
+	dc->dc_out = kmem_alloc(ROUNDS * DEC_CTLEN, KM_SLEEP);
+
+	for (int i = 0; i < ARRAY_SIZE(aes_mechs); i++)
+		dec_speed(dc, aes_mechs[i]);
+
+	kmem_free(dc->dc_pt, ROUNDS * ENCBLKSZ);
+	kmem_free(dc->dc_ct, ROUNDS * DEC_CTLEN);
+	kmem_free(dc->dc_out, ROUNDS * DEC_CTLEN);
+	kmem_free(dc, sizeof (*dc));
+}
@@ -0,0 +1,255 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://opensource.org/licenses/CDDL-1.0
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+/*
+ * Copyright 2014 by Saso Kiselkov. All rights reserved.
+ */
+
+/*
+ * CPU and memory placement matrix for the speed test. Every scenario
+ * runs one or two bound worker threads at the same time, each on its
+ * own buffers, starting from the benchmark CPU (crypto_test_bench_cpu):
+ *
+ *	local	one worker, buffers in its own lgroup
+ *	remote	one worker, buffers in another lgroup
+ *	smt	two workers on hardware threads of the same core, which
+ *		share that core's AES and carry-less multiply units
+ *	core	two workers on different cores of the same chip
+ *	socket	two workers on different chips
+ *	peer	two workers, the second one on crypto_test_peer_cpu
+ *
+ * Scenarios the machine can't provide (e.g. remote on a single-lgroup
+ * box) are reported as such and skipped. Per-CPU throughput is also
+ * given as a percentage of the single local worker, which makes the
+ * cross-socket and SMT penalties easy to read off.
+ */
+
+#include <sys/types.h>
+#include <sys/cmn_err.h>
+#include <sys/ddi.h>
+#include <sys/sunddi.h>
+#include <sys/thread.h>
+#include <sys/cpuvar.h>
+#include <sys/systm.h>
+#include <sys/sysmacros.h>
+#include <sys/crypto/common.h>
+#include <sys/crypto/api.h>
+
+#include "crypto_test.h"
+
+#define	PLACE_MAXWORKERS	2
+
+int crypto_test_peer_cpu = -1;
+
+typedef enum place_peer {
+	PEER_NONE,
+	PEER_SMT,
+	PEER_CORE,
+	PEER_SOCKET,
+	PEER_TUNABLE
+} place_peer_t;
+
+typedef struct place_scen {
+	const char	*ps_name;
+	place_peer_t	ps_peer;
+	buf_policy_t	ps_policy;
+} place_scen_t;
+
+static const place_scen_t place_scens[] = {
+	{ "local",	PEER_NONE,	BUF_POLICY_LOCAL },
+	{ "remote",	PEER_NONE,	BUF_POLICY_REMOTE },
+	{ "smt",	PEER_SMT,	BUF_POLICY_LOCAL },
+	{ "core",	PEER_CORE,	BUF_POLICY_LOCAL },
+	{ "socket",	PEER_SOCKET,	BUF_POLICY_LOCAL },
+	{ "peer",	PEER_TUNABLE,	BUF_POLICY_LOCAL }
+};
+
+typedef struct place_worker {
+	workers_t	*pw_workers;
+	processorid_t	pw_cpu;
+	buf_policy_t	pw_policy;
+	const char	*pw_mech;
+	uint64_t	pw_rate;
+} place_worker_t;
+
+/*
+ * Finds an online CPU standing in relation `peer' to CPU `id', or -1.
+ */
+static processorid_t
+place_find_peer(processorid_t id, place_peer_t peer)
+{
+	processorid_t found = -1;
+	cpu_t *me, *cp;
+
+	if (peer == PEER_TUNABLE) {
+		id = crypto_test_peer_cpu;
+		mutex_enter(&cpu_lock);
+		if (id >= 0 && id < max_ncpus && cpu[id] != NULL &&
+		    cpu_is_online(cpu[id]))
+			found = id;
+		mutex_exit(&cpu_lock);
+		return (found);
+	}
+
+	mutex_enter(&cpu_lock);
+	me = cpu[id];
+	cp = cpu_list;
+	do {
+		boolean_t chip, core;
+
+		if (cp == me || !cpu_is_online(cp)) {
+			cp = cp->cpu_next;
+			continue;
+		}
+		chip = (cpuid_get_chipid(cp) == cpuid_get_chipid(me));
+		core = (chip && cpuid_get_coreid(cp) == cpuid_get_coreid(me));
+		if ((peer == PEER_SMT && core) ||
+		    (peer == PEER_CORE && chip && !core) ||
+		    (peer == PEER_SOCKET && !chip)) {
+			found = cp->cpu_id;
+			break;
+		}
+		cp = cp->cpu_next;
+	} while (cp != cpu_list);
+	mutex_exit(&cpu_lock);
+
+	return (found);
+}
+
+/*
+ * Homes itself on its CPU's lgroup, since thread_create() may have put
+ * it anywhere, and allocates its buffers before binding (the NUMA
+ * policies bind the thread themselves while allocating). Then waits for
+ * the other workers and runs the speed test on its CPU.
+ */
+static void
+place_worker(void *arg)
+{
+	place_worker_t *pw = arg;
+	bench_bufs_t bufs;
+	boolean_t homed, have_bufs, bound;
+	lpl_t *home, *bound_home;
+
+	homed = bench_rehome(pw->pw_cpu, &home);
+	have_bufs = (homed &&
+	    bench_bufs_alloc(&bufs, pw->pw_policy, pw->pw_cpu));
+	bound = bench_bind(pw->pw_cpu, &bound_home);
+
+	(void) workers_sync(pw->pw_workers);
+
+	if (have_bufs && bound) {
+		pw->pw_rate = speed_run(pw->pw_mech, B_TRUE, bufs.bbs_in.bb_va,
+		    bufs.bbs_out.bb_va, NULL);
+	}
+	if (have_bufs)
+		bench_bufs_free(&bufs);
+	if (bound)
+		bench_unbind(bound_home);
+	if (homed)
+		bench_unhome(home);
+}
+
+/*
+ * Runs `nworkers' workers simultaneously and returns their summed
+ * throughput, or 0 if any of them failed.
+ */
+static uint64_t
+place_run(place_worker_t *pw, int nworkers)
+{
+	workers_t wk;
+	uint64_t total = 0;
+
+	for (int i = 0; i < nworkers; i++) {
+		pw[i].pw_workers = &wk;
+		pw[i].pw_rate = 0;
+	}
+	workers_start(&wk, nworkers, place_worker, pw, sizeof (*pw));
+	workers_go(&wk);
+	workers_wait(&wk);
+
+	for (int i = 0; i < nworkers; i++) {
+		if (pw[i].pw_rate == 0)
+			return (0);
+		total += pw[i].pw_rate;
+	}
+
+	return (total);
+}
+
+void
+speed_test_placement(void)
+{
+	processorid_t id = bench_cpu();
+	uint64_t base[ARRAY_SIZE(aes_mechs)];
+
+	bzero(base, sizeof (base));
+	for (int s = 0; s < ARRAY_SIZE(place_scens); s++) {
+		const place_scen_t *ps = &place_scens[s];
+		place_worker_t pw[PLACE_MAXWORKERS];
+		int nworkers = 1;
+
+		pw[0].pw_cpu = id;
+		pw[0].pw_policy = ps->ps_policy;
+		if (ps->ps_peer != PEER_NONE) {
+			pw[1].pw_cpu = place_find_peer(id, ps->ps_peer);
+			pw[1].pw_policy = ps->ps_policy;
+			nworkers = 2;
+			if (pw[1].pw_cpu == -1) {
+				cmn_err(CE_NOTE, "P[%s]: no suitable CPU",
+				    ps->ps_name);
+				continue;
+			}
+		} else if (ps->ps_policy == BUF_POLICY_REMOTE &&
+		    cpu_find_lgrp_peer(id, B_FALSE) == -1) {
+			cmn_err(CE_NOTE, "P[%s]: single lgroup system",
+			    ps->ps_name);
+			continue;
+		}
+
+		for (int m = 0; m < ARRAY_SIZE(aes_mechs); m++) {
+			uint64_t total, per_cpu;
+			char pct[8] = "n/a";
+
+			for (int i = 0; i < nworkers; i++)
+				pw[i].pw_mech = aes_mechs[m];
+			total = place_run(pw, nworkers);
+			if (total == 0) {
+				cmn_err(CE_NOTE, "P[%s] E[%s]: failed",
+				    ps->ps_name, aes_mechs[m]);
+				continue;
+			}
+			per_cpu = total / nworkers;
+			if (s == 0)
+				base[m] = per_cpu;
+			if (base[m] != 0) {
+				(void) snprintf(pct, sizeof (pct), "%llu%%",
+				    (unsigned long long)(per_cpu * 100 /
+				    base[m]));
+			}
+
+			cmn_err(CE_NOTE, "P[%s] E[%s] cpus %d,%d: %llu MB/s "
+			    "total, %llu MB/s per cpu (%s of local)",
+			    ps->ps_name, aes_mechs[m], pw[0].pw_cpu,
+			    nworkers > 1 ? pw[1].pw_cpu : -1,
+			    (unsigned long long)total >> 20,
+			    (unsigned long long)per_cpu >> 20, pct);
+		}
+	}
+}
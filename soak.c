@@ -0,0 +1,552 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://opensource.org/licenses/CDDL-1.0
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+/*
+ * Copyright 2014 by Saso Kiselkov. All rights reserved.
+ */
+
+/*
+ * Soak test. One worker per CPU runs a random mix of mechanisms, key
+ * sizes, message sizes, directions and update splits for
+ * crypto_test_soak_secs seconds. Every multi-part result is checked
+ * against the same operation done as a single atomic crypto_encrypt(),
+ * and decryption runs on ciphertext made that way, so GCM tags always
+ * have to verify. Since both of those run the same provider code, the
+ * atomic ciphertext is itself checked without the provider's mode code
+ * (see soak_ref_check()), and each worker runs a few known answer
+ * vectors every SOAK_KAT_EVERY operations for the block cipher and
+ * GHASH.
+ *
+ * Every crypto_test_soak_interval seconds we print the throughput,
+ * latency percentiles of whole init-to-final operations, kernel heap
+ * size, free memory and the number of framework contexts in use. The
+ * interval after the first (warm-up) one is the baseline, even if
+ * nothing completed in it. We warn when throughput falls or p99 latency
+ * rises by more than crypto_test_soak_drift_pct percent (clamped to
+ * 0-100) against it, when the heap grows by more than
+ * crypto_test_soak_growth_mb MiB, or when more than
+ * crypto_test_soak_ctx_slack extra contexts are live, which would point
+ * at a context leak.
+ */
+
+#include <sys/types.h>
+#include <sys/cmn_err.h>
+#include <sys/random.h>
+#include <sys/atomic.h>
+#include <sys/ddi.h>
+#include <sys/sunddi.h>
+#include <sys/thread.h>
+#include <sys/cpuvar.h>
+#include <sys/time.h>
+#include <sys/bitmap.h>
+#include <sys/kmem.h>
+#include <sys/vmem.h>
+#include <sys/systm.h>
+#include <sys/sysmacros.h>
+#include <sys/sdt.h>
+#include <vm/seg_kmem.h>
+#include <sys/crypto/common.h>
+#include <sys/crypto/api.h>
+#include <sys/crypto/sched_impl.h>
+
+#include "crypto_test.h"
+
+#define	SOAK_MAXLEN	65536
+#define	SOAK_MAXAAD	64
+#define	SOAK_MAXCUTS	4
+#define	SOAK_NBUCKETS	256
+#define	SOAK_MAX_REPORT	16
+#define	SOAK_KAT_EVERY	4096
+
+int crypto_test_soak_secs = 4 * 3600;
+int crypto_test_soak_interval = 60;
+int crypto_test_soak_drift_pct = 10;
+int crypto_test_soak_growth_mb = 64;
+int crypto_test_soak_ctx_slack = 1024;
+
+typedef struct soak_kat {
+	const char	*sk_mech;
+	uint8_t		sk_key[32];
+	size_t		sk_key_len;
+	uint8_t		sk_pt[AES_BLOCK_LEN];
+	uint8_t		sk_ct[2 * AES_BLOCK_LEN];	/* GCM: ct || tag */
+} soak_kat_t;
+
+/* FIPS-197 appendix C.1-C.3 and test case 2 of the GCM specification */
+static const soak_kat_t soak_kats[] = {
+	{ SUN_CKM_AES_ECB,
+	    { 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+	    0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f }, 16,
+	    { 0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77,
+	    0x88, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff },
+	    { 0x69, 0xc4, 0xe0, 0xd8, 0x6a, 0x7b, 0x04, 0x30,
+	    0xd8, 0xcd, 0xb7, 0x80, 0x70, 0xb4, 0xc5, 0x5a } },
+	{ SUN_CKM_AES_ECB,
+	    { 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+	    0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
+	    0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17 }, 24,
+	    { 0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77,
+	    0x88, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff },
+	    { 0xdd, 0xa9, 0x7c, 0xa4, 0x86, 0x4c, 0xdf, 0xe0,
+	    0x6e, 0xaf, 0x70, 0xa0, 0xec, 0x0d, 0x71, 0x91 } },
+	{ SUN_CKM_AES_ECB,
+	    { 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+	    0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
+	    0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17,
+	    0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f }, 32,
+	    { 0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77,
+	    0x88, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff },
+	    { 0x8e, 0xa2, 0xb7, 0xca, 0x51, 0x67, 0x45, 0xbf,
+	    0xea, 0xfc, 0x49, 0x90, 0x4b, 0x49, 0x60, 0x89 } },
+	{ SUN_CKM_AES_GCM, { 0 }, 16, { 0 },
+	    { 0x03, 0x88, 0xda, 0xce, 0x60, 0xb6, 0xa3, 0x92,
+	    0xf3, 0x28, 0xc2, 0xb9, 0x71, 0xb2, 0xfe, 0x78,
+	    0xab, 0x6e, 0x47, 0xd4, 0x2c, 0xec, 0x13, 0xbd,
+	    0xf5, 0x3a, 0x67, 0xb2, 0x12, 0x57, 0xbd, 0xdf } }
+};
+
+typedef struct soak_stats {
+	uint64_t	ss_ops;
+	uint64_t	ss_bytes;
+	uint64_t	ss_errors;
+	uint64_t	ss_hist[SOAK_NBUCKETS];
+} soak_stats_t;
+
+typedef struct soak_run {
+	workers_t	sr_workers;
+	volatile boolean_t sr_stop;
+	uint32_t	sr_reported;
+} soak_run_t;
+
+typedef struct soak_worker {
+	soak_run_t	*sw_run;
+	soak_stats_t	sw_stats;
+} soak_worker_t;
+
+typedef struct soak_sample {
+	uint64_t	sm_rate;
+	uint64_t	sm_p99;
+	uint64_t	sm_heap;
+	uint64_t	sm_ctx;
+} soak_sample_t;
+
+/*
+ * Latency histogram with four linear sub-buckets per power of two, so
+ * the percentiles are good to within 25%.
+ */
+static int
+soak_bucket(uint64_t ns)
+{
+	int msb;
+
+	if (ns < 4)
+		return ((int)ns);
+	msb = highbit64(ns) - 1;
+
+	return (4 * (msb - 1) + (int)((ns >> (msb - 2)) & 3));
+}
+
+static uint64_t
+soak_bucket_max(int b)
+{
+	int msb = b / 4 + 1;
+
+	if (b < 4)
+		return (b);
+
+	return (((4ULL + b % 4 + 1) << (msb - 2)) - 1);
+}
+
+static uint64_t
+soak_percentile(const uint64_t *hist, uint64_t total, int permille)
+{
+	uint64_t target = (total * permille + 999) / 1000, seen = 0;
+
+	for (int b = 0; b < SOAK_NBUCKETS; b++) {
+		seen += hist[b];
+		if (seen >= target && seen != 0)
+			return (soak_bucket_max(b));
+	}
+
+	return (0);
+}
+
+static void
+soak_fail(soak_run_t *sr, soak_stats_t *ss, const char *mech_name,
+    boolean_t encrypt, const char *what, size_t len, int ncuts, int rv)
+{
+	ss->ss_errors++;
+	if (atomic_inc_32_nv(&sr->sr_reported) <= SOAK_MAX_REPORT) {
+		cmn_err(CE_WARN, "SOAK/%s/%s: BAD %s: len %llu in %d updates, "
+		    "rv %x", mech_short_name(mech_name), encrypt ? "E" : "D",
+		    what, (unsigned long long)len, ncuts + 1, rv);
+	}
+}
+
+/*
+ * Runs the known answer vectors, which pin down the key schedule and
+ * block cipher for every key size, and GHASH.
+ */
+static void
+soak_kat(soak_run_t *sr, soak_stats_t *ss)
+{
+	for (int i = 0; i < ARRAY_SIZE(soak_kats); i++) {
+		const soak_kat_t *sk = &soak_kats[i];
+		boolean_t gcm = (strcmp(sk->sk_mech, SUN_CKM_AES_GCM) == 0);
+		size_t ct_len = (gcm ? 2 : 1) * AES_BLOCK_LEN;
+		uint8_t iv[12], out[2 * AES_BLOCK_LEN];
+		crypto_mechanism_t mech;
+		mech_params_t mp;
+		crypto_key_t kcf_key;
+		crypto_data_t kcf_in, kcf_out;
+		boolean_t ok;
+		int rv;
+
+		bzero(iv, sizeof (iv));
+		CRYPTO_SET_RAW_KEY(kcf_key, sk->sk_key, sk->sk_key_len);
+		mech_setup(&mech, &mp, sk->sk_mech, iv, sizeof (iv), NULL, 0,
+		    AES_BLOCK_LEN);
+		CRYPTO_SET_RAW_DATA(kcf_in, sk->sk_pt, AES_BLOCK_LEN);
+		CRYPTO_SET_RAW_DATA(kcf_out, out, ct_len);
+		DTRACE_PROBE3(crypto_test__verify__start, char *, sk->sk_mech,
+		    size_t, AES_BLOCK_LEN, kthread_t *, curthread);
+		rv = crypto_encrypt(&mech, &kcf_in, &kcf_key, NULL, &kcf_out,
+		    NULL);
+		ok = (rv == CRYPTO_SUCCESS && kcf_out.cd_length == ct_len &&
+		    bcmp(out, sk->sk_ct, ct_len) == 0);
+		DTRACE_PROBE3(crypto_test__verify__done, char *, sk->sk_mech,
+		    boolean_t, ok, kthread_t *, curthread);
+		if (!ok) {
+			soak_fail(sr, ss, sk->sk_mech, B_TRUE, "known answer",
+			    AES_BLOCK_LEN, 0, rv);
+		}
+	}
+}
+
+/*
+ * Checks that `ct' is the ciphertext of `msg' without going through the
+ * provider's mode code: CBC by ECB-decrypting it and chaining by hand,
+ * CTR and the GCM payload against a keystream made by ECB-encrypting
+ * counter blocks (see ctr.c). What's left, the block cipher itself and
+ * the GCM tag, is up to soak_kat(). `s1' and `s2' are scratch space of
+ * at least `len' rounded up to a whole block.
+ */
+static boolean_t
+soak_ref_check(const char *mech_name, crypto_key_t *key, const uint8_t *iv,
+    const uint8_t *msg, size_t len, const uint8_t *ct, uint8_t *s1,
+    uint8_t *s2)
+{
+	size_t nblocks = P2ROUNDUP(len, AES_BLOCK_LEN) / AES_BLOCK_LEN;
+	uint8_t cb[AES_BLOCK_LEN];
+	crypto_mechanism_t mech;
+	crypto_data_t kcf_in, kcf_out;
+	int rv;
+
+	if (strcmp(mech_name, SUN_CKM_AES_CBC) == 0) {
+		mech.cm_type = crypto_mech2id(SUN_CKM_AES_ECB);
+		mech.cm_param = NULL;
+		mech.cm_param_len = 0;
+		CRYPTO_SET_RAW_DATA(kcf_in, ct, len);
+		CRYPTO_SET_RAW_DATA(kcf_out, s1, len);
+		if (crypto_decrypt(&mech, &kcf_in, key, NULL, &kcf_out,
+		    NULL) != CRYPTO_SUCCESS)
+			return (B_FALSE);
+		for (size_t i = 0; i < len; i++)
+			s1[i] ^= (i < AES_BLOCK_LEN ? iv[i] :
+			    ct[i - AES_BLOCK_LEN]);
+		return (bcmp(s1, msg, len) == 0);
+	} else if (strcmp(mech_name, SUN_CKM_AES_CTR) == 0) {
+		rv = ctr_ref_keystream(key, iv, 128, nblocks, s1, s2);
+	} else if (strcmp(mech_name, SUN_CKM_AES_GCM) == 0) {
+		/* with a 96-bit IV the payload starts at counter IV || 2 */
+		bzero(cb, sizeof (cb));
+		bcopy(iv, cb, 12);
+		cb[AES_BLOCK_LEN - 1] = 2;
+		rv = ctr_ref_keystream(key, cb, 32, nblocks, s1, s2);
+	} else {
+		return (B_TRUE);
+	}
+	if (rv != CRYPTO_SUCCESS)
+		return (B_FALSE);
+	for (size_t i = 0; i < len; i++)
+		s2[i] ^= msg[i];
+
+	return (bcmp(s2, ct, len) == 0);
+}
+
+/*
+ * Runs one random operation and accounts for it in `ss'.
+ */
+static void
+soak_op(soak_run_t *sr, soak_stats_t *ss, uint8_t *msg, uint8_t *in,
+    uint8_t *ref, uint8_t *out, uint8_t *s1, uint8_t *s2)
+{
+	const char *mech_name = aes_mechs[rand_below(ARRAY_SIZE(aes_mechs))];
+	boolean_t gcm = (strcmp(mech_name, SUN_CKM_AES_GCM) == 0);
+	boolean_t block = (!gcm && strcmp(mech_name, SUN_CKM_AES_CTR) != 0);
+	boolean_t encrypt = rand_below(2);
+	size_t key_len = 16 + 8 * rand_below(3);
+	size_t aad_len = gcm ? rand_below(SOAK_MAXAAD + 1) : 0;
+	size_t buflen = SOAK_MAXLEN + AES_BLOCK_LEN;
+	size_t len, in_len, ref_len, off = 0, pos = 0;
+	size_t cuts[SOAK_MAXCUTS];
+	int ncuts = rand_below(SOAK_MAXCUTS + 1);
+	uint8_t K[32], iv[AES_BLOCK_LEN], aad[SOAK_MAXAAD];
+	crypto_mechanism_t mech;
+	mech_params_t mp;
+	crypto_key_t kcf_key;
+	crypto_data_t kcf_in, kcf_ref;
+	crypto_context_t ctx;
+	hrtime_t start;
+	boolean_t ok;
+	int rv;
+
+	len = AES_BLOCK_LEN + rand_below(SOAK_MAXLEN - AES_BLOCK_LEN + 1);
+	if (block)
+		len &= ~(AES_BLOCK_LEN - 1);
+	(void) random_get_pseudo_bytes(K, key_len);
+	(void) random_get_pseudo_bytes(iv, sizeof (iv));
+	(void) random_get_pseudo_bytes(aad, aad_len);
+	(void) random_get_pseudo_bytes(msg, len);
+	CRYPTO_SET_RAW_KEY(kcf_key, K, key_len);
+	mech_setup(&mech, &mp, mech_name, iv, gcm ? 12 : sizeof (iv), aad,
+	    aad_len, AES_BLOCK_LEN);
+
+	/* the atomic encryption is the reference, or the input to decrypt */
+	CRYPTO_SET_RAW_DATA(kcf_in, msg, len);
+	CRYPTO_SET_RAW_DATA(kcf_ref, encrypt ? ref : in, buflen);
+	rv = crypto_encrypt(&mech, &kcf_in, &kcf_key, NULL, &kcf_ref, NULL);
+	if (rv != CRYPTO_SUCCESS) {
+		soak_fail(sr, ss, mech_name, encrypt, "atomic", len, 0, rv);
+		return;
+	}
+	DTRACE_PROBE3(crypto_test__verify__start, char *, mech_name,
+	    size_t, len, kthread_t *, curthread);
+	ok = soak_ref_check(mech_name, &kcf_key, iv, msg, len,
+	    encrypt ? ref : in, s1, s2);
+	DTRACE_PROBE3(crypto_test__verify__done, char *, mech_name,
+	    boolean_t, ok, kthread_t *, curthread);
+	if (!ok) {
+		soak_fail(sr, ss, mech_name, encrypt, "reference", len, 0, rv);
+		return;
+	}
+	if (encrypt) {
+		bcopy(msg, in, len);
+		in_len = len;
+		ref_len = kcf_ref.cd_length;
+	} else {
+		in_len = kcf_ref.cd_length;
+		bcopy(msg, ref, len);
+		ref_len = len;
+	}
+
+	for (int i = 0; i < ncuts; i++)
+		cuts[i] = (i + 1) * in_len / (ncuts + 1);
+
+	start = gethrtime();
+	rv = crypt_init(mech_name, &mech, &kcf_key, NULL, encrypt, &ctx);
+	for (int i = 0; rv == CRYPTO_SUCCESS && i <= ncuts; i++) {
+		size_t end = (i < ncuts ? cuts[i] : in_len);
+
+		rv = crypt_update(ctx, encrypt, in + pos, end - pos, out,
+		    buflen, &off);
+		pos = end;
+	}
+	if (rv == CRYPTO_SUCCESS)
+		rv = crypt_final(ctx, encrypt, out, buflen, &off);
+	if (rv == CRYPTO_SUCCESS)
+		ss->ss_hist[soak_bucket(gethrtime() - start)]++;
+
+	DTRACE_PROBE3(crypto_test__verify__start, char *, mech_name,
+	    size_t, ref_len, kthread_t *, curthread);
+	ok = (rv == CRYPTO_SUCCESS && off == ref_len &&
+	    bcmp(out, ref, ref_len) == 0);
+	DTRACE_PROBE3(crypto_test__verify__done, char *, mech_name,
+	    boolean_t, ok, kthread_t *, curthread);
+	if (!ok) {
+		soak_fail(sr, ss, mech_name, encrypt, "multi-part", in_len,
+		    ncuts, rv);
+		return;
+	}
+	ss->ss_ops++;
+	ss->ss_bytes += in_len;
+}
+
+static void
+soak_worker(void *arg)
+{
+	soak_worker_t *sw = arg;
+	soak_run_t *sr = sw->sw_run;
+	size_t buflen = SOAK_MAXLEN + AES_BLOCK_LEN;
+	uint8_t *msg = kmem_alloc(buflen, KM_SLEEP);
+	uint8_t *in = kmem_alloc(buflen, KM_SLEEP);
+	uint8_t *ref = kmem_alloc(buflen, KM_SLEEP);
+	uint8_t *out = kmem_alloc(buflen, KM_SLEEP);
+	uint8_t *s1 = kmem_alloc(buflen, KM_SLEEP);
+	uint8_t *s2 = kmem_alloc(buflen, KM_SLEEP);
+
+	(void) workers_sync(&sr->sr_workers);
+	DTRACE_PROBE3(crypto_test__run__start, char *, "SOAK",
+	    boolean_t, B_TRUE, kthread_t *, curthread);
+	for (uint64_t n = 0; !sr->sr_stop; n++) {
+		if (n % SOAK_KAT_EVERY == 0)
+			soak_kat(sr, &sw->sw_stats);
+		soak_op(sr, &sw->sw_stats, msg, in, ref, out, s1, s2);
+	}
+	DTRACE_PROBE3(crypto_test__run__done, char *, "SOAK",
+	    uint64_t, sw->sw_stats.ss_bytes, kthread_t *, curthread);
+
+	kmem_free(msg, buflen);
+	kmem_free(in, buflen);
+	kmem_free(ref, buflen);
+	kmem_free(out, buflen);
+	kmem_free(s1, buflen);
+	kmem_free(s2, buflen);
+}
+
+/*
+ * Prints one interval's statistics from the difference between `cur'
+ * and `prev' and checks them against the baseline, if we have one yet.
+ */
+static void
+soak_report(int secs, int interval, const soak_stats_t *cur,
+    const soak_stats_t *prev, soak_sample_t *base, boolean_t *have_base)
+{
+	uint64_t hist[SOAK_NBUCKETS];
+	uint64_t ops = cur->ss_ops - prev->ss_ops;
+	uint64_t drift = MIN(MAX(crypto_test_soak_drift_pct, 0), 100);
+	soak_sample_t sm;
+
+	for (int b = 0; b < SOAK_NBUCKETS; b++)
+		hist[b] = cur->ss_hist[b] - prev->ss_hist[b];
+	sm.sm_rate = (cur->ss_bytes - prev->ss_bytes) / interval;
+	sm.sm_p99 = soak_percentile(hist, ops, 990);
+	sm.sm_heap = vmem_size(heap_arena, VMEM_ALLOC);
+	sm.sm_ctx = kmem_cache_stat(kcf_context_cache, "buf_inuse");
+
+	cmn_err(CE_NOTE, "SOAK %d s: %llu MB/s, %llu ops/s, latency p50 "
+	    "%llu p99 %llu p99.9 %llu ns, heap %llu MB, free %llu MB, "
+	    "kcf ctx %llu, errors %llu", secs,
+	    (unsigned long long)sm.sm_rate >> 20,
+	    (unsigned long long)(ops / interval),
+	    (unsigned long long)soak_percentile(hist, ops, 500),
+	    (unsigned long long)sm.sm_p99,
+	    (unsigned long long)soak_percentile(hist, ops, 999),
+	    (unsigned long long)sm.sm_heap >> 20,
+	    (unsigned long long)ptob(freemem) >> 20,
+	    (unsigned long long)sm.sm_ctx,
+	    (unsigned long long)cur->ss_errors);
+
+	if (!*have_base) {
+		if (secs >= 2 * interval) {
+			*base = sm;
+			*have_base = B_TRUE;
+		}
+		return;
+	}
+
+	if (sm.sm_rate * 100 < base->sm_rate * (100 - drift)) {
+		cmn_err(CE_WARN, "SOAK %d s: throughput down to %llu%% of "
+		    "baseline", secs,
+		    (unsigned long long)(sm.sm_rate * 100 / base->sm_rate));
+	}
+	if (sm.sm_p99 * 100 > base->sm_p99 * (100 + drift)) {
+		cmn_err(CE_WARN, "SOAK %d s: p99 latency up to %llu%% of "
+		    "baseline", secs, (unsigned long long)(sm.sm_p99 * 100 /
+		    MAX(base->sm_p99, 1)));
+	}
+	if (sm.sm_heap > base->sm_heap +
+	    ((uint64_t)crypto_test_soak_growth_mb << 20)) {
+		cmn_err(CE_WARN, "SOAK %d s: kernel heap grew by %llu MB",
+		    secs,
+		    (unsigned long long)(sm.sm_heap - base->sm_heap) >> 20);
+	}
+	if (sm.sm_ctx > base->sm_ctx + crypto_test_soak_ctx_slack) {
+		cmn_err(CE_WARN, "SOAK %d s: %llu more kcf contexts in use "
+		    "than at baseline", secs,
+		    (unsigned long long)(sm.sm_ctx - base->sm_ctx));
+	}
+}
+
+static void
+soak_sum(soak_worker_t *sw, int nworkers, soak_stats_t *total)
+{
+	bzero(total, sizeof (*total));
+	for (int i = 0; i < nworkers; i++) {
+		const soak_stats_t *ss = &sw[i].sw_stats;
+
+		total->ss_ops += ss->ss_ops;
+		total->ss_bytes += ss->ss_bytes;
+		total->ss_errors += ss->ss_errors;
+		for (int b = 0; b < SOAK_NBUCKETS; b++)
+			total->ss_hist[b] += ss->ss_hist[b];
+	}
+}
+
+void
+test_soak(void)
+{
+	int nworkers = ncpus;
+	int interval = MAX(crypto_test_soak_interval, 1);
+	soak_worker_t *sw = kmem_zalloc(nworkers * sizeof (*sw), KM_SLEEP);
+	soak_stats_t *cur = kmem_zalloc(sizeof (*cur), KM_SLEEP);
+	soak_stats_t *prev = kmem_zalloc(sizeof (*prev), KM_SLEEP);
+	soak_sample_t base;
+	boolean_t have_base = B_FALSE;
+	soak_run_t sr;
+
+	bzero(&sr, sizeof (sr));
+	bzero(&base, sizeof (base));
+
+	cmn_err(CE_NOTE, "SOAK: %d workers for %d s, reporting every %d s",
+	    nworkers, crypto_test_soak_secs, interval);
+	for (int i = 0; i < nworkers; i++)
+		sw[i].sw_run = &sr;
+	workers_start(&sr.sr_workers, nworkers, soak_worker, sw,
+	    sizeof (*sw));
+	workers_go(&sr.sr_workers);
+
+	for (int secs = interval; secs <= crypto_test_soak_secs;
+	    secs += interval) {
+		soak_stats_t *tmp;
+
+		delay(interval * hz);
+		soak_sum(sw, nworkers, cur);
+		soak_report(secs, interval, cur, prev, &base, &have_base);
+		tmp = prev;
+		prev = cur;
+		cur = tmp;
+	}
+
+	sr.sr_stop = B_TRUE;
+	workers_wait(&sr.sr_workers);
+
+	soak_sum(sw, nworkers, cur);
+	cmn_err(cur->ss_errors == 0 ? CE_NOTE : CE_WARN, "SOAK: %s "
+	    "(%llu operations, %llu MB, %llu errors)",
+	    cur->ss_errors == 0 ? "OK" : "BAD",
+	    (unsigned long long)cur->ss_ops,
+	    (unsigned long long)cur->ss_bytes >> 20,
+	    (unsigned long long)cur->ss_errors);
+
+	kmem_free(sw, nworkers * sizeof (*sw));
+	kmem_free(cur, sizeof (*cur));
+	kmem_free(prev, sizeof (*prev));
+}
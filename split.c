@@ -0,0 +1,313 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://opensource.org/licenses/CDDL-1.0
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+/*
+ * Copyright 2014 by Saso Kiselkov. All rights reserved.
+ */
+
+/*
+ * Update-split fuzzing. Every random message is first run through a
+ * single update to get a reference result, then again cut at random
+ * byte offsets into many updates (including empty ones), which forces
+ * the providers through their partial-block buffering between calls.
+ * Both results must match. GCM decryption inputs are produced by a
+ * one-shot encryption first, so the tag always verifies.
+ *
+ * speed_test_split() measures what the residual handling costs by
+ * feeding the same stream in block-aligned chunks and in chunks which
+ * are SPLIT_SKEW bytes longer, so nearly every update leaves a partial
+ * block behind.
+ */
+
+#include <sys/types.h>
+#include <sys/cmn_err.h>
+#include <sys/random.h>
+#include <sys/ddi.h>
+#include <sys/sunddi.h>
+#include <sys/systm.h>
+#include <sys/sysmacros.h>
+#include <sys/sdt.h>
+#include <sys/crypto/common.h>
+#include <sys/crypto/api.h>
+
+#include "crypto_test.h"
+
+#define	SPLIT_MAXLEN	4096
+#define	SPLIT_MAXCUTS	64
+#define	SPLIT_MAXAAD	64
+#define	SPLIT_MAX_REPORT	8
+
+#define	SPLIT_MSGLEN	(1024 * 1024)
+#define	SPLIT_SKEW	7
+
+int crypto_test_split_iters = 1024;
+
+static const size_t split_chunks[] = { 16, 64, 256, 1024, 4096, 16384 };
+
+/*
+ * Runs `in' through a fresh context in ncuts + 1 updates, split at the
+ * sorted offsets in `cuts', and returns the total output size in `*off'.
+ */
+static int
+split_run(const char *mech_name, crypto_mechanism_t *mech, crypto_key_t *key,
+    boolean_t encrypt, const uint8_t *in, size_t len, const size_t *cuts,
+    int ncuts, uint8_t *out, size_t out_len, size_t *off)
+{
+	crypto_context_t ctx;
+	size_t pos = 0;
+	int rv;
+
+	*off = 0;
+	rv = crypt_init(mech_name, mech, key, NULL, encrypt, &ctx);
+	if (rv != CRYPTO_SUCCESS)
+		return (rv);
+
+	for (int i = 0; i <= ncuts; i++) {
+		size_t end = (i < ncuts ? cuts[i] : len);
+
+		rv = crypt_update(ctx, encrypt, in + pos, end - pos, out,
+		    out_len, off);
+		if (rv != CRYPTO_SUCCESS)
+			return (rv);
+		pos = end;
+	}
+
+	return (crypt_final(ctx, encrypt, out, out_len, off));
+}
+
+static void
+split_cuts(size_t *cuts, int ncuts, size_t len)
+{
+	for (int i = 0; i < ncuts; i++) {
+		size_t c = rand_below(len + 1);
+		int j;
+
+		for (j = i; j > 0 && cuts[j - 1] > c; j--)
+			cuts[j] = cuts[j - 1];
+		cuts[j] = c;
+	}
+}
+
+static void
+test_split(const char *mech_name, boolean_t encrypt)
+{
+	const char *short_name = mech_short_name(mech_name);
+	boolean_t gcm = (strcmp(mech_name, SUN_CKM_AES_GCM) == 0);
+	boolean_t block = (!gcm && strcmp(mech_name, SUN_CKM_AES_CTR) != 0);
+	size_t buflen = SPLIT_MAXLEN + AES_BLOCK_LEN;
+	uint8_t *msg = kmem_alloc(buflen, KM_SLEEP);
+	uint8_t *in = kmem_alloc(buflen, KM_SLEEP);
+	uint8_t *ref = kmem_alloc(buflen, KM_SLEEP);
+	uint8_t *out = kmem_alloc(buflen, KM_SLEEP);
+	uint8_t K[32], iv[AES_BLOCK_LEN], aad[SPLIT_MAXAAD];
+	size_t cuts[SPLIT_MAXCUTS];
+	uint64_t nupdates = 0;
+	int nbad = 0, nmsgs = 0;
+
+	for (int iter = 0; iter < crypto_test_split_iters; iter++) {
+		size_t key_len = 16 + 8 * rand_below(3);
+		size_t aad_len = gcm ? rand_below(SPLIT_MAXAAD + 1) : 0;
+		size_t len, in_len, ref_len, out_len;
+		int ncuts = 1 + rand_below(SPLIT_MAXCUTS);
+		crypto_mechanism_t mech;
+		mech_params_t mp;
+		crypto_key_t kcf_key;
+		boolean_t ok;
+		int rv;
+
+		nmsgs++;
+		len = rand_below(SPLIT_MAXLEN + 1);
+		if (block)
+			len &= ~(AES_BLOCK_LEN - 1);
+		(void) random_get_pseudo_bytes(K, key_len);
+		(void) random_get_pseudo_bytes(iv, sizeof (iv));
+		(void) random_get_pseudo_bytes(aad, aad_len);
+		(void) random_get_pseudo_bytes(msg, len);
+
+		CRYPTO_SET_RAW_KEY(kcf_key, K, key_len);
+		mech_setup(&mech, &mp, mech_name, iv, gcm ? 12 : sizeof (iv),
+		    aad, aad_len, AES_BLOCK_LEN);
+
+		in_len = len;
+		bcopy(msg, in, len);
+		if (gcm && !encrypt) {
+			/* need a real ciphertext for the tag to verify */
+			rv = split_run(mech_name, &mech, &kcf_key, B_TRUE,
+			    msg, len, NULL, 0, in, buflen, &in_len);
+			if (rv != CRYPTO_SUCCESS) {
+				cmn_err(CE_WARN, "SPLIT/%s/D: setup problem: "
+				    "%x", short_name, rv);
+				nbad++;
+				break;
+			}
+		}
+
+		rv = split_run(mech_name, &mech, &kcf_key, encrypt, in, in_len,
+		    NULL, 0, ref, buflen, &ref_len);
+		if (rv != CRYPTO_SUCCESS) {
+			cmn_err(CE_WARN, "SPLIT/%s/%s: one-shot problem: %x",
+			    short_name, encrypt ? "E" : "D", rv);
+			nbad++;
+			break;
+		}
+
+		split_cuts(cuts, ncuts, in_len);
+		nupdates += ncuts + 1;
+		rv = split_run(mech_name, &mech, &kcf_key, encrypt, in, in_len,
+		    cuts, ncuts, out, buflen, &out_len);
+		DTRACE_PROBE3(crypto_test__verify__start, char *, mech_name,
+		    size_t, ref_len, kthread_t *, curthread);
+		ok = (rv == CRYPTO_SUCCESS && out_len == ref_len &&
+		    bcmp(out, ref, ref_len) == 0 &&
+		    (encrypt || !gcm || bcmp(out, msg, len) == 0));
+		DTRACE_PROBE3(crypto_test__verify__done, char *, mech_name,
+		    boolean_t, ok, kthread_t *, curthread);
+		if (ok)
+			continue;
+
+		if (++nbad <= SPLIT_MAX_REPORT) {
+			cmn_err(CE_WARN, "SPLIT/%s/%s: BAD: len %llu in %d "
+			    "updates, first cut at %llu, rv %x, got %llu bytes "
+			    "of %llu", short_name, encrypt ? "E" : "D",
+			    (unsigned long long)in_len, ncuts + 1,
+			    (unsigned long long)cuts[0], rv,
+			    (unsigned long long)out_len,
+			    (unsigned long long)ref_len);
+		}
+	}
+
+	if (nbad == 0) {
+		cmn_err(CE_NOTE, "SPLIT/%s/%s: OK (%d messages, %llu updates)",
+		    short_name, encrypt ? "E" : "D", nmsgs,
+		    (unsigned long long)nupdates);
+	} else {
+		cmn_err(CE_WARN, "SPLIT/%s/%s: BAD: %d of %d", short_name,
+		    encrypt ? "E" : "D", nbad, nmsgs);
+	}
+
+	kmem_free(msg, buflen);
+	kmem_free(in, buflen);
+	kmem_free(ref, buflen);
+	kmem_free(out, buflen);
+}
+
+void
+test_split_all(void)
+{
+	for (int i = 0; i < ARRAY_SIZE(aes_mechs); i++) {
+		test_split(aes_mechs[i], B_TRUE);
+		test_split(aes_mechs[i], B_FALSE);
+	}
+}
+
+/*
+ * Encrypts SPLIT_MSGLEN-byte messages in `chunk'-sized updates for
+ * SPEED_TEST_TIME seconds and returns the throughput in bytes/s.
+ */
+static uint64_t
+split_speed(const char *mech_name, size_t chunk, uint8_t *input,
+    uint8_t *output, size_t out_len)
+{
+	uint8_t K[16], iv[AES_BLOCK_LEN];
+	crypto_mechanism_t mech;
+	mech_params_t mp;
+	crypto_key_t kcf_key;
+	crypto_context_t ctx;
+	clock_t start, end;
+	uint64_t processed = 0;
+	int rv;
+
+	bzero(K, sizeof (K));
+	bzero(iv, sizeof (iv));
+	CRYPTO_SET_RAW_KEY(kcf_key, K, sizeof (K));
+	mech_setup(&mech, &mp, mech_name, iv, 12, NULL, 0, AES_BLOCK_LEN);
+
+	DTRACE_PROBE3(crypto_test__run__start, char *, mech_name,
+	    boolean_t, B_TRUE, kthread_t *, curthread);
+	start = ddi_get_lbolt();
+	for (;;) {
+		size_t off = 0;
+
+		rv = crypt_init(mech_name, &mech, &kcf_key, NULL, B_TRUE,
+		    &ctx);
+		if (rv != CRYPTO_SUCCESS) {
+			cmn_err(CE_NOTE, "Init problem: %x", rv);
+			goto out;
+		}
+		for (size_t pos = 0; pos < SPLIT_MSGLEN; pos += chunk) {
+			rv = crypt_update(ctx, B_TRUE, input + pos,
+			    MIN(chunk, SPLIT_MSGLEN - pos), output, out_len,
+			    &off);
+			if (rv != CRYPTO_SUCCESS) {
+				cmn_err(CE_NOTE, "Update problem: %x", rv);
+				goto out;
+			}
+		}
+		rv = crypt_final(ctx, B_TRUE, output, out_len, &off);
+		if (rv != CRYPTO_SUCCESS) {
+			cmn_err(CE_NOTE, "Final problem: %x", rv);
+			goto out;
+		}
+
+		processed += SPLIT_MSGLEN;
+
+		end = ddi_get_lbolt();
+		if (start + SPEED_TEST_TIME * hz < end)
+			break;
+	}
+out:
+	DTRACE_PROBE3(crypto_test__run__done, char *, mech_name,
+	    uint64_t, processed, kthread_t *, curthread);
+	if (rv != CRYPTO_SUCCESS)
+		return (0);
+
+	return ((processed * hz) / (end - start));
+}
+
+void
+speed_test_split(void)
+{
+	size_t out_len = SPLIT_MSGLEN + AES_BLOCK_LEN;
+	uint8_t *input = kmem_zalloc(SPLIT_MSGLEN, KM_SLEEP);
+	uint8_t *output = kmem_zalloc(out_len, KM_SLEEP);
+
+	for (int i = 0; i < ARRAY_SIZE(aes_mechs); i++) {
+		for (int j = 0; j < ARRAY_SIZE(split_chunks); j++) {
+			size_t chunk = split_chunks[j];
+			uint64_t aligned, skewed;
+
+			aligned = split_speed(aes_mechs[i], chunk, input,
+			    output, out_len);
+			skewed = split_speed(aes_mechs[i], chunk + SPLIT_SKEW,
+			    input, output, out_len);
+			cmn_err(CE_NOTE, "E[%s] %llu-byte updates: %llu MB/s, "
+			    "%llu-byte updates: %llu MB/s (%llu%%)",
+			    aes_mechs[i], (unsigned long long)chunk,
+			    (unsigned long long)aligned >> 20,
+			    (unsigned long long)(chunk + SPLIT_SKEW),
+			    (unsigned long long)skewed >> 20,
+			    aligned == 0 ? 0ULL :
+			    (unsigned long long)(skewed * 100 / aligned));
+		}
+	}
+
+	kmem_free(input, SPLIT_MSGLEN);
+	kmem_free(output, out_len);
+}
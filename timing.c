@@ -0,0 +1,467 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://opensource.org/licenses/CDDL-1.0
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+/*
+ * Copyright 2014 by Saso Kiselkov. All rights reserved.
+ */
+
+/*
+ * Timing side-channel analysis along the lines of dudect (Reparaz,
+ * Balasch & Verbauwhede, "Dude, is my code constant time?", 2017).
+ *
+ * Every measurement picks one of two input classes at random: class 0
+ * always uses the same fixed input, class 1 a fresh random one. For GCM
+ * tags both classes are forgeries, class 0 with the first and class 1
+ * with the last tag byte corrupted, so that an early-exit tag compare
+ * shows up. Valid vs corrupted tags always differ, since only a valid
+ * tag makes the provider copy the plaintext out, so that test is only
+ * reported for information and gets no verdict. The operation
+ * is timed with the unscaled hrtime source and Welch's t-test is run
+ * between the two classes, both on all samples and on several sets
+ * cropped at percentiles taken from a calibration batch, which weeds
+ * out interrupts and other one-sided noise. |t| above 4.5 suggests
+ * data-dependent timing and above 10 is a near certain leak.
+ *
+ * Kernel code can't use the FPU, so each class keeps exact integer sums
+ * of the samples and their squares, and the means and variances are
+ * worked out from those once, in fixed point, at the end. Samples are
+ * clamped to TIMING_CLAMP ticks and a run to TIMING_MAXSAMPLES samples,
+ * which keeps the sums of squares inside 64 bits.
+ */
+
+#include <sys/types.h>
+#include <sys/cmn_err.h>
+#include <sys/random.h>
+#include <sys/time.h>
+#include <sys/thread.h>
+#include <sys/cpuvar.h>
+#include <sys/disp.h>
+#include <sys/systm.h>
+#include <sys/sysmacros.h>
+#include <sys/x86_archext.h>
+#include <sys/crypto/common.h>
+#include <sys/crypto/api.h>
+
+#include "crypto_test.h"
+
+#define	TIMING_MSGLEN	512
+#define	TIMING_BATCH	4096
+#define	TIMING_CLAMP	(1 << 18)
+#define	TIMING_MAXSAMPLES	(1 << 27)
+
+int crypto_test_timing_samples = 1000000;
+
+typedef enum timing_kind {
+	TIMING_PT,		/* fixed vs random plaintext, timed update */
+	TIMING_KEY,		/* fixed vs random key, timed init */
+	TIMING_TAG,		/* first vs last GCM tag byte corrupted */
+	TIMING_TAG_VALID	/* valid vs corrupted GCM tag, informational */
+} timing_kind_t;
+
+#define	TIMING_IS_TAG(kind)	\
+	((kind) == TIMING_TAG || (kind) == TIMING_TAG_VALID)
+
+static const char *timing_kind_names[] = {
+	"plaintext", "key", "tag", "valid tag"
+};
+
+typedef struct timing_test {
+	const char	*tt_mech;
+	timing_kind_t	tt_kind;
+} timing_test_t;
+
+static const timing_test_t timing_tests[] = {
+	{ SUN_CKM_AES_ECB, TIMING_PT },
+	{ SUN_CKM_AES_ECB, TIMING_KEY },
+	{ SUN_CKM_AES_CBC, TIMING_PT },
+	{ SUN_CKM_AES_CBC, TIMING_KEY },
+	{ SUN_CKM_AES_CTR, TIMING_PT },
+	{ SUN_CKM_AES_CTR, TIMING_KEY },
+	{ SUN_CKM_AES_GCM, TIMING_PT },
+	{ SUN_CKM_AES_GCM, TIMING_KEY },
+	{ SUN_CKM_AES_GCM, TIMING_TAG },
+	{ SUN_CKM_AES_GCM, TIMING_TAG_VALID }
+};
+
+/* Crop points in permille; 1000 means all samples. */
+static const int timing_crops[] = { 1000, 500, 750, 900, 950, 990, 999 };
+#define	TIMING_NCROPS	ARRAY_SIZE(timing_crops)
+
+typedef struct welch {
+	uint64_t	w_n[2];
+	uint64_t	w_sum[2];
+	uint64_t	w_sum2[2];
+} welch_t;
+
+typedef struct timing_state {
+	const timing_test_t	*ts_test;
+	crypto_mechanism_t	ts_mech;
+	mech_params_t		ts_mp;
+	uint8_t			ts_key[16];
+	uint8_t			ts_iv[AES_BLOCK_LEN];
+	uint8_t			ts_fixed[TIMING_MSGLEN + AES_BLOCK_LEN];
+	uint8_t			ts_out[TIMING_MSGLEN + AES_BLOCK_LEN];
+	size_t			ts_inlen;
+	uint8_t			*ts_inputs;	/* TIMING_BATCH x ts_inlen */
+	uint8_t			*ts_classes;
+	hrtime_t		*ts_times;
+	hrtime_t		ts_thresh[TIMING_NCROPS];
+	welch_t			ts_welch[TIMING_NCROPS];
+	uint64_t		ts_errors;
+} timing_state_t;
+
+static void
+welch_push(welch_t *w, int cls, hrtime_t t)
+{
+	uint64_t x = MIN(t, TIMING_CLAMP);
+
+	w->w_n[cls]++;
+	w->w_sum[cls] += x;
+	w->w_sum2[cls] += x * x;
+}
+
+/*
+ * Returns floor(num * 2^shift / den) without overflowing as long as the
+ * quotient and den themselves leave shift bits of headroom.
+ */
+static uint64_t
+fp_div(uint64_t num, uint64_t den, int shift)
+{
+	return (((num / den) << shift) + (((num % den) << shift) / den));
+}
+
+static uint64_t
+isqrt64(uint64_t x)
+{
+	uint64_t r = 0, bit = 1ULL << 62;
+
+	while (bit > x)
+		bit >>= 2;
+	while (bit != 0) {
+		if (x >= r + bit) {
+			x -= r + bit;
+			r = (r >> 1) + bit;
+		} else {
+			r >>= 1;
+		}
+		bit >>= 2;
+	}
+
+	return (r);
+}
+
+/*
+ * Returns Welch's t statistic times 100. The sum of squared deviations
+ * is sum2 - sum^2 / n, with sum^2 / n expanded around the integer mean
+ * m = sum / n (sum = m * n + r) so that no term overflows. The means and
+ * the standard error carry 12 fractional bits, the variances 8 before
+ * var/n is scaled by a further 2^16 ahead of the square root.
+ */
+static int64_t
+welch_t100(const welch_t *w)
+{
+	uint64_t se2 = 0, se, mean[2];
+
+	for (int c = 0; c < 2; c++) {
+		uint64_t n = w->w_n[c], m, r, m2;
+
+		if (n < 2)
+			return (0);
+		m = w->w_sum[c] / n;
+		r = w->w_sum[c] % n;
+		m2 = w->w_sum2[c] - m * m * n - 2 * m * r - r * r / n;
+		se2 += (fp_div(m2, n - 1, 8) << 16) / n;
+		mean[c] = fp_div(w->w_sum[c], n, 12);
+	}
+	if ((se = isqrt64(se2)) == 0)
+		return (0);
+
+	return (((int64_t)mean[0] - (int64_t)mean[1]) * 100 / (int64_t)se);
+}
+
+static uint64_t
+welch_mean(const welch_t *w, int cls)
+{
+	return (w->w_n[cls] == 0 ? 0 : w->w_sum[cls] / w->w_n[cls]);
+}
+
+/*
+ * The CPU features the AES provider picks its code path by. KCF doesn't
+ * tell us which path a provider actually took.
+ */
+static const char *
+timing_cpu_features(const timing_test_t *tt)
+{
+	boolean_t aesni = is_x86_feature(x86_featureset, X86FSET_AES);
+
+	if (strcmp(tt->tt_mech, SUN_CKM_AES_GCM) == 0 && aesni &&
+	    is_x86_feature(x86_featureset, X86FSET_PCLMULQDQ))
+		return ("aesni+pclmulqdq");
+
+	return (aesni ? "aesni" : "generic");
+}
+
+/*
+ * Fills in one batch worth of classes and inputs, so that no random
+ * number generation happens between the timestamps.
+ */
+static void
+timing_prepare(timing_state_t *ts)
+{
+	timing_kind_t kind = ts->ts_test->tt_kind;
+
+	(void) random_get_pseudo_bytes(ts->ts_classes, TIMING_BATCH);
+	for (int i = 0; i < TIMING_BATCH; i++) {
+		uint8_t *in = ts->ts_inputs + i * ts->ts_inlen;
+		int cls = (ts->ts_classes[i] &= 1);
+		uint8_t flip = 0;
+
+		bcopy(ts->ts_fixed, in, ts->ts_inlen);
+		if (kind != TIMING_TAG && cls == 0)
+			continue;
+		if (!TIMING_IS_TAG(kind)) {
+			(void) random_get_pseudo_bytes(in, ts->ts_inlen);
+			continue;
+		}
+
+		while (flip == 0)
+			flip = rand_below(256);
+		if (kind == TIMING_TAG)
+			in[TIMING_MSGLEN + cls * (AES_BLOCK_LEN - 1)] ^= flip;
+		else
+			in[TIMING_MSGLEN + rand_below(AES_BLOCK_LEN)] ^= flip;
+	}
+}
+
+/*
+ * Takes one measurement of input `in'. Only the part of the operation
+ * which depends on the class varying is inside the timestamps, and
+ * preemption is off across them. Interrupts can still land inside a
+ * sample; the cropped sets are there to throw those out.
+ */
+static hrtime_t
+timing_measure(timing_state_t *ts, const uint8_t *in, int cls)
+{
+	timing_kind_t kind = ts->ts_test->tt_kind;
+	boolean_t encrypt = !TIMING_IS_TAG(kind);
+	const uint8_t *key = (kind == TIMING_KEY ? in : ts->ts_key);
+	crypto_context_t ctx;
+	crypto_key_t kcf_key;
+	hrtime_t start, end;
+	size_t off = 0;
+	int rv;
+
+	CRYPTO_SET_RAW_KEY(kcf_key, key, sizeof (ts->ts_key));
+
+	if (kind == TIMING_KEY) {
+		kpreempt_disable();
+		start = gethrtime_unscaled();
+		rv = crypto_encrypt_init(&ts->ts_mech, &kcf_key, NULL, &ctx,
+		    NULL);
+		end = gethrtime_unscaled();
+		kpreempt_enable();
+		if (rv != CRYPTO_SUCCESS)
+			goto errout;
+		crypto_cancel_ctx(ctx);
+		return (end - start);
+	}
+
+	if (encrypt)
+		rv = crypto_encrypt_init(&ts->ts_mech, &kcf_key, NULL, &ctx,
+		    NULL);
+	else
+		rv = crypto_decrypt_init(&ts->ts_mech, &kcf_key, NULL, &ctx,
+		    NULL);
+	if (rv != CRYPTO_SUCCESS)
+		goto errout;
+
+	kpreempt_disable();
+	start = gethrtime_unscaled();
+	rv = crypt_update(ctx, encrypt, in, ts->ts_inlen, ts->ts_out,
+	    sizeof (ts->ts_out), &off);
+	if (rv == CRYPTO_SUCCESS && !encrypt) {
+		rv = crypt_final(ctx, B_FALSE, ts->ts_out,
+		    sizeof (ts->ts_out), &off);
+		end = gethrtime_unscaled();
+		kpreempt_enable();
+		if (rv != (kind == TIMING_TAG_VALID && cls == 0 ?
+		    CRYPTO_SUCCESS : CRYPTO_INVALID_MAC))
+			goto errout;
+		return (end - start);
+	}
+	end = gethrtime_unscaled();
+	kpreempt_enable();
+	if (rv != CRYPTO_SUCCESS)
+		goto errout;
+	rv = crypt_final(ctx, B_TRUE, ts->ts_out, sizeof (ts->ts_out), &off);
+	if (rv != CRYPTO_SUCCESS)
+		goto errout;
+
+	return (end - start);
+
+errout:
+	ts->ts_errors++;
+	return (-1);
+}
+
+static void
+timing_batch(timing_state_t *ts)
+{
+	timing_prepare(ts);
+	for (int i = 0; i < TIMING_BATCH; i++) {
+		ts->ts_times[i] = timing_measure(ts,
+		    ts->ts_inputs + i * ts->ts_inlen, ts->ts_classes[i]);
+	}
+}
+
+static int
+timing_cmp(const void *a, const void *b)
+{
+	hrtime_t x = *(const hrtime_t *)a, y = *(const hrtime_t *)b;
+
+	return (x < y ? -1 : x > y);
+}
+
+/*
+ * The first batch only sets the crop thresholds, the same way dudect
+ * throws its first batch away.
+ */
+static void
+timing_calibrate(timing_state_t *ts)
+{
+	timing_batch(ts);
+	qsort(ts->ts_times, TIMING_BATCH, sizeof (hrtime_t), timing_cmp);
+	for (int c = 0; c < TIMING_NCROPS; c++) {
+		ts->ts_thresh[c] = (timing_crops[c] == 1000 ? INT64_MAX :
+		    ts->ts_times[TIMING_BATCH * timing_crops[c] / 1000]);
+	}
+}
+
+static void
+test_timing(const timing_test_t *tt)
+{
+	timing_state_t *ts = kmem_zalloc(sizeof (*ts), KM_SLEEP);
+	const char *short_name = mech_short_name(tt->tt_mech);
+	crypto_context_t ctx;
+	crypto_key_t kcf_key;
+	uint64_t n = 0, nsamples;
+	int64_t best = 0;
+	int best_crop = 0;
+	size_t off = 0;
+
+	ts->ts_test = tt;
+	(void) random_get_pseudo_bytes(ts->ts_key, sizeof (ts->ts_key));
+	(void) random_get_pseudo_bytes(ts->ts_iv, sizeof (ts->ts_iv));
+	mech_setup(&ts->ts_mech, &ts->ts_mp, tt->tt_mech, ts->ts_iv, 12,
+	    NULL, 0, AES_BLOCK_LEN);
+
+	switch (tt->tt_kind) {
+	case TIMING_PT:
+		ts->ts_inlen = TIMING_MSGLEN;
+		(void) random_get_pseudo_bytes(ts->ts_fixed, ts->ts_inlen);
+		break;
+	case TIMING_KEY:
+		ts->ts_inlen = sizeof (ts->ts_key);
+		(void) random_get_pseudo_bytes(ts->ts_fixed, ts->ts_inlen);
+		break;
+	case TIMING_TAG:
+	case TIMING_TAG_VALID:
+		/* a genuine ciphertext with its valid tag to corrupt */
+		ts->ts_inlen = TIMING_MSGLEN + AES_BLOCK_LEN;
+		(void) random_get_pseudo_bytes(ts->ts_out, TIMING_MSGLEN);
+		CRYPTO_SET_RAW_KEY(kcf_key, ts->ts_key, sizeof (ts->ts_key));
+		if (crypto_encrypt_init(&ts->ts_mech, &kcf_key, NULL, &ctx,
+		    NULL) != CRYPTO_SUCCESS ||
+		    crypt_update(ctx, B_TRUE, ts->ts_out, TIMING_MSGLEN,
+		    ts->ts_fixed, ts->ts_inlen, &off) != CRYPTO_SUCCESS ||
+		    crypt_final(ctx, B_TRUE, ts->ts_fixed, ts->ts_inlen,
+		    &off) != CRYPTO_SUCCESS || off != ts->ts_inlen) {
+			cmn_err(CE_WARN, "T[%s] tag: setup problem",
+			    short_name);
+			goto out;
+		}
+		break;
+	}
+
+	ts->ts_inputs = kmem_alloc(TIMING_BATCH * ts->ts_inlen, KM_SLEEP);
+	ts->ts_classes = kmem_alloc(TIMING_BATCH, KM_SLEEP);
+	ts->ts_times = kmem_alloc(TIMING_BATCH * sizeof (hrtime_t), KM_SLEEP);
+
+	/* keep the CPU and its caches constant for the whole run */
+	thread_affinity_set(curthread, CPU_CURRENT);
+	nsamples = MIN(crypto_test_timing_samples, TIMING_MAXSAMPLES);
+	timing_calibrate(ts);
+	while (n < nsamples) {
+		timing_batch(ts);
+		for (int i = 0; i < TIMING_BATCH; i++) {
+			hrtime_t t = ts->ts_times[i];
+
+			if (t < 0)
+				continue;
+			for (int c = 0; c < TIMING_NCROPS; c++) {
+				if (t <= ts->ts_thresh[c]) {
+					welch_push(&ts->ts_welch[c],
+					    ts->ts_classes[i], t);
+				}
+			}
+		}
+		n += TIMING_BATCH;
+	}
+	thread_affinity_clear(curthread);
+
+	for (int c = 0; c < TIMING_NCROPS; c++) {
+		int64_t t = welch_t100(&ts->ts_welch[c]);
+
+		if (t < 0)
+			t = -t;
+		if (t > best) {
+			best = t;
+			best_crop = c;
+		}
+	}
+	cmn_err(CE_NOTE, "T[%s] %s (cpu features: %s): %llu samples, mean "
+	    "%llu/%llu ticks, max |t| = %lld.%02lld (%d.%d%% crop): %s",
+	    short_name, timing_kind_names[tt->tt_kind],
+	    timing_cpu_features(tt), (unsigned long long)n,
+	    (unsigned long long)welch_mean(&ts->ts_welch[0], 0),
+	    (unsigned long long)welch_mean(&ts->ts_welch[0], 1),
+	    (long long)best / 100, (long long)best % 100,
+	    timing_crops[best_crop] / 10, timing_crops[best_crop] % 10,
+	    tt->tt_kind == TIMING_TAG_VALID ? "informational" :
+	    best < 450 ? "OK" : best < 1000 ? "SUSPECT" : "LEAK");
+	if (ts->ts_errors != 0) {
+		cmn_err(CE_WARN, "T[%s] %s: %llu operations failed",
+		    short_name, timing_kind_names[tt->tt_kind],
+		    (unsigned long long)ts->ts_errors);
+	}
+
+	kmem_free(ts->ts_inputs, TIMING_BATCH * ts->ts_inlen);
+	kmem_free(ts->ts_classes, TIMING_BATCH);
+	kmem_free(ts->ts_times, TIMING_BATCH * sizeof (hrtime_t));
+out:
+	kmem_free(ts, sizeof (*ts));
+}
+
+void
+test_timing_all(void)
+{
+	for (int i = 0; i < ARRAY_SIZE(timing_tests); i++)
+		test_timing(&timing_tests[i]);
+}